@@ -1,18 +1,43 @@
 #include <math.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #if defined(__APPLE__)
 #include <OpenGL/gl.h>
+#include <OpenGL/glext.h>
 #include <OpenGL/glu.h>
 #include <GLUT/glut.h>
 #else
+#define GL_GLEXT_PROTOTYPES
 #include <GL/glut.h>
 #endif
+#if defined(__linux__)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
 #include <vector>
 #include <string>
 #if defined(__APPLE__)
-#include <signal.h>
-#include <sys/types.h>
+#include <AudioToolbox/AudioToolbox.h>
+#endif
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #endif
 
@@ -140,76 +165,223 @@ struct Player {
 	bool airborne;
 };
 
-struct Goal {
-	Vector3f position;
-	bool collected;
+// Entity store. Props and goals are kept as structure-of-arrays so per-tick
+// updates run as tight loops over contiguous floats. Props are sorted by
+// model; modelStart[m]..modelStart[m + 1] is the range drawn with model m.
+enum PropModel {
+	MODEL_FLOODLIGHT,
+	MODEL_AIRLOCK,
+	MODEL_CORAL,
+	MODEL_CONSOLE,
+	MODEL_DRONE,
+	MODEL_COUNT
 };
 
-struct AnimationController {
-	bool active;
-	float phase;
+struct PropStore {
+	std::vector<float> x, y, z;
+	std::vector<float> phase;
+	std::vector<float> speed;
+	std::vector<unsigned char> active;
+	std::vector<unsigned char> model;
+	int modelStart[MODEL_COUNT + 1];
+
+	size_t size() const {
+		return phase.size();
+	}
+};
+
+struct GoalStore {
+	std::vector<float> x, y, z;
+	std::vector<unsigned char> collected;
+
+	size_t size() const {
+		return collected.size();
+	}
+};
+
+// Uniform grid over the arena floor (x/z) holding the goals not yet collected.
+// Each cell owns a range of `slots`; its live goals sit at the front of that
+// range, so collecting one is a swap with the last live slot.
+struct GoalGrid {
+	int columns;
+	float cellSize;
+	std::vector<int> cellStart; // first slot of each cell, plus an end marker
+	std::vector<int> cellLive;  // live goals per cell
+	std::vector<int> slots;     // goal indices grouped by cell
+};
+
+// Everything a playthrough needs. Stepping a session touches no GL, GLUT or
+// audio; side effects the frontend cares about are raised in `events`.
+enum SessionEvent {
+	SESSION_EVENT_GOAL = 1 << 0,         // a goal was collected
+	SESSION_EVENT_TIME_WARNING = 1 << 1, // 10 seconds left
+	SESSION_EVENT_HYPE = 1 << 2          // the Crab Rave drop, 78 seconds left
+};
+
+struct GameSession {
+	GameState state;
+	float remainingTime;
+	float goalRotation;
+	float wallColorPhase;
+	Player player;
+	GoalStore goals;
+	GoalGrid goalGrid;
+	int goalsLeft;
+	std::vector<int> pickups; // goals collected since the owner last cleared events
+	PropStore props;
+	bool moveForward;
+	bool moveBackward;
+	bool moveLeft;
+	bool moveRight;
+	bool moveUp;
+	bool moveDown;
+	bool timeWarningRaised;
+	bool hypeRaised;
+	unsigned int events; // SessionEvent bits raised since the owner last cleared them
 };
 
 Camera camera(1.8f, 0.9f, 1.8f, 0.0f, 0.3f, 0.0f, 0.0f, 1.0f, 0.0f);
-Player player;
-std::vector<Goal> goals;
-AnimationController objectControllers[5];
+GameSession game;
 
 const char *SOUND_TRACK = "assets/audio/Crab Rave Noisestorm.mp3";
 const char *SOUND_SERVO = "assets/audio/Mechanical Servo Tremolo by Patrick Lieberkind.wav";
 const char *SOUND_GOAL = "assets/audio/Underwater Bubbles by Robinhood76.wav";
 const char *SOUND_BUZZER = "assets/audio/Time Running Out Buzzer.wav";
 
-#if defined(__APPLE__)
-pid_t backgroundMusicPid = -1;
-#endif
+enum SoundAsset {
+	SOUND_ASSET_MUSIC,
+	SOUND_ASSET_SERVO,
+	SOUND_ASSET_GOAL,
+	SOUND_ASSET_BUZZER,
+	SOUND_ASSET_COUNT
+};
 
-bool loseSoundPlayed = false;
-bool winSoundPlayed = false;
+int lastTick = 0;
+
+// The simulation advances in fixed steps; rendering reads an interpolation
+// between the last two simulated states so motion stays smooth at any frame rate.
+struct RenderState {
+	Vector3f playerPosition;
+	float playerYaw;
+	float playerTilt;
+	std::vector<float> phases; // one per prop, in PropStore order
+	float goalRotation;
+	float wallColorPhase;
+};
 
-GameState gameState = STATE_PLAYING;
+const float SIM_STEP = 1.0f / 120.0f;
+const float MAX_FRAME_TIME = 0.25f; // longer hitches are dropped instead of caught up
 
-bool moveForward = false;
-bool moveBackward = false;
-bool moveLeft = false;
-bool moveRight = false;
-bool moveUp = false;
-bool moveDown = false;
+float simAccumulator = 0.0f;
+unsigned int simTick = 0; // simulation steps taken since startup, never reset
+RenderState previousState;
+RenderState currentState;
+RenderState renderState;
 
-float goalRotation = 0.0f;
-float wallColorPhase = 0.0f;
-float remainingTime = 120.0f;
-int lastTick = 0;
+// Scene description: arena bounds, props, goals and lights. It comes from a
+// binary .arsc file that is memory-mapped and read in place (loadScene), or
+// from the built-in layout below. Files are little-endian with 4-byte aligned
+// records so the arrays can be used straight out of the mapping.
+const unsigned int SCENE_FILE_VERSION = 1;
+const int MAX_SCENE_LIGHTS = 8;
+const float MAX_SCENE_HALF = 1000.0f;  // largest arena half-extent a file may ask for
+const float MAX_SCENE_HEIGHT = 100.0f;
+// Smallest arena the random scatter fits in: it keeps 0.1 away from the walls
+// and places goals between PLAYER_RADIUS and half the ceiling
+const float MIN_SCENE_HALF = 0.2f;
+const float MIN_SCENE_HEIGHT = 0.2f;
+
+struct SceneFileHeader {
+	char magic[4]; // "ARSC"
+	unsigned int version;
+	float half;      // arena half-extent on x and z
+	float maxHeight; // highest point the player can swim to
+	unsigned int propCount, propOffset; // offsets are in bytes from the start of the file
+	unsigned int goalCount, goalOffset;
+	unsigned int lightCount, lightOffset;
+};
+
+struct ScenePropRecord {
+	float x, y, z;
+	unsigned int model; // PropModel
+};
+
+struct SceneGoalRecord {
+	float x, y, z;
+};
+
+struct SceneLightRecord {
+	float position[4];
+	float diffuse[4];
+	float specular[4];
+	float attenuation[3]; // constant, linear, quadratic
+};
+
+struct Scene {
+	float half;
+	float maxHeight;
+	const ScenePropRecord *props;
+	unsigned int propCount;
+	const SceneGoalRecord *goals;
+	unsigned int goalCount;
+	const SceneLightRecord *lights;
+	unsigned int lightCount;
+};
+
+const ScenePropRecord DEFAULT_PROPS[] = {
+	{ -0.75f, 0.0f, -0.65f, MODEL_FLOODLIGHT },
+	{ 0.0f, 0.0f, -0.95f, MODEL_AIRLOCK },
+	{ 0.68f, 0.0f, -0.35f, MODEL_CORAL },
+	{ -0.55f, 0.0f, 0.55f, MODEL_CONSOLE },
+	{ 0.45f, 0.0f, 0.75f, MODEL_DRONE }
+};
+
+const SceneGoalRecord DEFAULT_GOALS[] = {
+	{ -0.55f, 0.12f, -0.45f },
+	{ 0.58f, 0.18f, 0.32f },
+	{ 0.1f, 0.14f, -0.05f }
+};
+
+const SceneLightRecord DEFAULT_LIGHTS[] = {
+	// Main overhead light (cool blue-white)
+	{ { 0.0f, 1.5f, 0.0f, 1.0f }, { 0.6f, 0.75f, 0.95f, 1.0f }, { 0.8f, 0.9f, 1.0f, 1.0f }, { 1.0f, 0.3f, 0.0f } },
+	// Secondary accent light (warm orange from equipment)
+	{ { -0.7f, 0.4f, -0.6f, 1.0f }, { 0.8f, 0.5f, 0.3f, 1.0f }, { 0.0f, 0.0f, 0.0f, 1.0f }, { 1.0f, 1.2f, 0.5f } }
+};
+
+Scene scene = { 1.0f, 0.85f, DEFAULT_PROPS, 5, DEFAULT_GOALS, 3, DEFAULT_LIGHTS, 2 };
 
-const float SCENE_HALF = 1.0f;
 const float GROUND_Y = 0.0f;
-const float MAX_HEIGHT = 0.85f;
 const float PLAYER_RADIUS = 0.05f;
 const float PLAYER_SPEED = 0.65f;
 const float PLAYER_ASCEND_SPEED = 0.5f;
 const float GOAL_RADIUS = 0.12f;
-
-// Music asset availability flags
-bool crabRaveAvailable = false;
-bool servoAvailable = false;
-bool goalAvailable = false;
-bool buzzerAvailable = false;
+const int GROUND_GRID_SIZE = 20;
+const int WALL_PANEL_COLUMNS = 5;
+const int WALL_PANEL_ROWS = 3;
+const float WALL_RIVET_RADIUS = 0.008f;
+const int WALL_RIVET_SLICES = 8;     // slices and stacks up close
+const int WALL_RIVET_SLICES_FAR = 4; // between the two pixel thresholds
+const float WALL_RIVET_FULL_PIXELS = 3.0f;
+const float WALL_RIVET_MIN_PIXELS = 1.0f;
+const int DRAW_JOB_SIZE = 64; // props or goals per scene traversal job
 
 void setupLights();
 void setupCamera();
 void resetGame();
+void syncRenderState();
+void applyReplayInputs(unsigned int tick);
+void handleKeyDown(unsigned char key);
+void handleKeyUp(unsigned char key);
+void handleSpecialKey(int key);
+void finishRecording();
 void updateGame(float dt);
 void drawScene();
 void drawGround();
-void drawWallPanel(float width, float height, float colorPhase);
+void drawWallPanel(const float wall[16], float width, float height, float colorPhase, int rivetSlices);
 void drawWalls();
 void drawPlayer();
-void drawGoals();
-void drawFloodlight(float rotation);
-void drawAirlock(float doorPhase);
-void drawCoralCluster(float swayPhase);
-void drawConsole(float pulsePhase);
-void drawDrone(float bobPhase);
+void drawGoalRange(int first, int last);
 void drawHud();
 void drawGameResult();
 void setFrontView();
@@ -218,1032 +390,4912 @@ void setTopView();
 void setFreeView();
 void startBackgroundMusic();
 void stopBackgroundMusic();
-void playEffect(const char *path);
+void playEffect(SoundAsset asset);
+void multiplyMatrix(const float a[16], const float b[16], float out[16]);
+
+// Frame section timing. Each zone accumulates the wall-clock time spent in it
+// during the current frame; with profileSync set (headless benchmark) every
+// zone ends with glFinish so the GPU work is attributed to the zone that
+// issued it.
+enum ProfileZone {
+	ZONE_UPDATE,
+	ZONE_GROUND,
+	ZONE_WALLS,
+	ZONE_FLOODLIGHT, // one zone per PropModel, in the same order
+	ZONE_AIRLOCK,
+	ZONE_CORAL,
+	ZONE_CONSOLE,
+	ZONE_DRONE,
+	ZONE_OCCLUSION,
+	ZONE_GOALS,
+	ZONE_PLAYER,
+	ZONE_RENDER_QUEUE,
+	ZONE_HUD,
+	ZONE_COUNT
+};
 
-bool fileExists(const char *filename) {
-    FILE *file = fopen(filename, "rb");
-    if (file) {
-        fclose(file);
-        return true;
-    }
-    return false;
+const char *PROFILE_ZONE_NAMES[ZONE_COUNT] = {
+	"updateGame", "drawGround", "drawWalls", "drawFloodlight", "drawAirlock",
+	"drawCoralCluster", "drawConsole", "drawDrone", "occlusionQueries", "drawGoals", "drawPlayer", "renderQueue", "drawHud"
+};
+
+double zoneMillis[ZONE_COUNT];
+bool profileSync = false;
+
+#ifndef GL_TIME_ELAPSED
+#define GL_TIME_ELAPSED 0x88BF
+#endif
+
+// Rolling history behind the on-screen profiler (F3). While the overlay is
+// visible every drawing zone is also wrapped in a GL_TIME_ELAPSED query. The
+// queries come in two sets that alternate per frame; a set is read back a
+// frame after it was issued and only once its result is available, so the
+// overlay never stalls the pipeline.
+const int PROFILE_HISTORY = 120;
+
+struct FrameProfiler {
+	bool visible;
+	bool gpuSupported;
+	GLuint queries[2][ZONE_COUNT];
+	bool issued[2][ZONE_COUNT];
+	bool gpuTimed[ZONE_COUNT]; // a query was ever issued; recording-only zones never issue one
+	int querySet; // set being issued this frame
+	double cpuHistory[ZONE_COUNT][PROFILE_HISTORY];
+	double gpuHistory[ZONE_COUNT][PROFILE_HISTORY];
+	double gpuMillis[ZONE_COUNT]; // latest GPU result per zone
+	int frame;
+};
+
+FrameProfiler profiler;
+
+bool timingOnGpu(ProfileZone zone) {
+	return profiler.visible && profiler.gpuSupported && zone != ZONE_UPDATE;
 }
 
-void checkMusicAssets() {
-    crabRaveAvailable = fileExists(SOUND_TRACK);
-    servoAvailable = fileExists(SOUND_SERVO);
-    goalAvailable = fileExists(SOUND_GOAL);
-    buzzerAvailable = fileExists(SOUND_BUZZER);
+double nowMillis() {
+	static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 }
 
-void playEffect(const char *path) {
-#if defined(__APPLE__)
-	if (!path || !fileExists(path)) {
-		return;
+class ProfileScope {
+public:
+	ProfileScope(ProfileZone zone) : zone(zone), start(nowMillis()) {
+		if (timingOnGpu(zone)) {
+			glBeginQuery(GL_TIME_ELAPSED, profiler.queries[profiler.querySet][zone]);
+			profiler.issued[profiler.querySet][zone] = true;
+			profiler.gpuTimed[zone] = true;
+		}
 	}
-	std::string command = "afplay -q 1 \"";
-	command += path;
-	command += "\" >/dev/null 2>&1 &";
-	system(command.c_str());
-#else
-	(void)path;
-#endif
-}
 
-void stopBackgroundMusic() {
-#if defined(__APPLE__)
-	if (backgroundMusicPid > 0) {
-		kill(backgroundMusicPid, SIGTERM);
-		backgroundMusicPid = -1;
+	~ProfileScope() {
+		if (timingOnGpu(zone)) {
+			glEndQuery(GL_TIME_ELAPSED);
+		}
+		if (profileSync) {
+			glFinish();
+		}
+		zoneMillis[zone] += nowMillis() - start;
+	}
+
+private:
+	ProfileZone zone;
+	double start;
+};
+
+void resetProfileZones() {
+	for (int i = 0; i < ZONE_COUNT; ++i) {
+		zoneMillis[i] = 0.0;
 	}
-	// Also kill any afplay processes playing our music file
-	std::string killCmd = "pkill -f 'afplay.*Crab Rave' 2>/dev/null";
-	system(killCmd.c_str());
-#endif
 }
 
-void startBackgroundMusic() {
-#if defined(__APPLE__)
-	stopBackgroundMusic();
-	if (crabRaveAvailable) {
-		// Create a background shell loop that plays the music
-		std::string command = "sh -c 'while true; do afplay \"";
-		command += SOUND_TRACK;
-		command += "\" 2>/dev/null; done' >/dev/null 2>&1 &";
-		system(command.c_str());
-		// Give it a moment to start, then find the process
-		usleep(100000); // 100ms
-		FILE* fp = popen("ps aux | grep 'afplay.*Crab Rave' | grep -v grep | awk '{print $2}' | head -1", "r");
-		if (fp) {
-			char buffer[32];
-			if (fgets(buffer, sizeof(buffer), fp) != NULL) {
-				backgroundMusicPid = atoi(buffer);
+// Called once per displayed frame: moves this frame's zone times into the
+// history and collects whichever GPU results from the previous frame are ready.
+void finishProfileFrame() {
+	int slot = profiler.frame % PROFILE_HISTORY;
+	if (profiler.visible && profiler.gpuSupported) {
+		int previous = profiler.querySet ^ 1;
+		for (int z = 0; z < ZONE_COUNT; ++z) {
+			if (!profiler.issued[previous][z]) {
+				continue;
+			}
+			GLuint available = 0;
+			glGetQueryObjectuiv(profiler.queries[previous][z], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available) {
+				GLuint nanoseconds = 0;
+				glGetQueryObjectuiv(profiler.queries[previous][z], GL_QUERY_RESULT, &nanoseconds);
+				profiler.gpuMillis[z] = nanoseconds / 1000000.0;
+				profiler.issued[previous][z] = false;
 			}
-			pclose(fp);
 		}
+		profiler.querySet = previous;
 	}
-#endif
+	for (int z = 0; z < ZONE_COUNT; ++z) {
+		profiler.cpuHistory[z][slot] = zoneMillis[z];
+		profiler.gpuHistory[z][slot] = profiler.gpuMillis[z];
+	}
+	++profiler.frame;
+	resetProfileZones();
 }
 
-int goalsRemaining() {
-	int count = 0;
-	for (size_t i = 0; i < goals.size(); ++i) {
-		if (!goals[i].collected) {
-			++count;
-		}
-	}
-	return count;
+// CPU time of a zone in the frame finishProfileFrame last recorded
+double lastZoneMillis(int zone) {
+	return profiler.cpuHistory[zone][(profiler.frame + PROFILE_HISTORY - 1) % PROFILE_HISTORY];
 }
 
-void initGoals() {
-	goals.clear();
-	goals.push_back({ Vector3f(-0.55f, 0.12f, -0.45f), false });
-	goals.push_back({ Vector3f(0.58f, 0.18f, 0.32f), false });
-	goals.push_back({ Vector3f(0.1f, 0.14f, -0.05f), false });
+// Timeline tracing (--trace file.json). Every thread records zones and
+// counters into its own ring buffer; a flusher thread drains the rings into a
+// Chrome trace-event file (chrome://tracing or ui.perfetto.dev), so the traced
+// threads never format text or touch the file.
+const unsigned int TRACE_RING_SIZE = 1 << 15;
+
+enum TraceRecordType {
+	TRACE_ZONE,
+	TRACE_COUNTER
+};
+
+struct TraceRecord {
+	const char *name; // string literal, lives for the whole run
+	double start;     // microseconds since startup
+	double duration;
+	long long value;  // counters only
+	TraceRecordType type;
+};
+
+// Single producer (the owning thread), single consumer (the flusher)
+struct TraceRing {
+	TraceRecord records[TRACE_RING_SIZE];
+	std::atomic<unsigned int> head;
+	std::atomic<unsigned int> tail;
+	std::atomic<unsigned int> dropped;
+	int threadId;
+	char threadName[32]; // copied, so callers may pass stack buffers
+	bool described; // thread_name metadata already written
+};
+
+struct Tracer {
+	std::atomic<bool> enabled;
+	std::atomic<bool> flushing;
+	FILE *file;
+	bool firstEvent;
+	std::mutex ringsLock; // ring registration against flushing
+	std::vector<TraceRing *> rings;
+	std::thread flusher;
+};
+
+Tracer tracer;
+thread_local TraceRing *traceRing = NULL;
+
+double nowMicros() {
+	return nowMillis() * 1000.0;
 }
 
-void resetPlayer() {
-	player.position = Vector3f(0.0f, PLAYER_RADIUS, 0.0f);
-	player.velocity = Vector3f();
-	player.yaw = 0.0f;
-	player.tilt = 0.0f;
-	player.airborne = false;
+// Gives the calling thread its ring; threads that never call this get one
+// named "worker" on their first record
+void traceThreadName(const char *name) {
+	if (!tracer.enabled.load()) {
+		return;
+	}
+	if (traceRing) {
+		snprintf(traceRing->threadName, sizeof(traceRing->threadName), "%s", name);
+		return;
+	}
+	TraceRing *ring = new TraceRing();
+	snprintf(ring->threadName, sizeof(ring->threadName), "%s", name);
+	std::lock_guard<std::mutex> lock(tracer.ringsLock);
+	ring->threadId = (int)tracer.rings.size() + 1;
+	tracer.rings.push_back(ring);
+	traceRing = ring;
 }
 
-void resetAnimations() {
-	for (int i = 0; i < 5; ++i) {
-		objectControllers[i].active = false;
-		objectControllers[i].phase = 0.0f;
+void traceRecord(const TraceRecord &record) {
+	if (!traceRing) {
+		traceThreadName("worker");
+		if (!traceRing) {
+			return; // tracing is off
+		}
+	}
+	unsigned int t = traceRing->tail.load(std::memory_order_relaxed);
+	if (t - traceRing->head.load(std::memory_order_acquire) == TRACE_RING_SIZE) {
+		traceRing->dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
 	}
+	traceRing->records[t % TRACE_RING_SIZE] = record;
+	traceRing->tail.store(t + 1, std::memory_order_release);
 }
 
-void resetGame() {
-	gameState = STATE_PLAYING;
-	remainingTime = 120.0f;
-	goalRotation = 0.0f;
-	wallColorPhase = 0.0f;
-	resetPlayer();
-	resetAnimations();
-	initGoals();
-	moveForward = moveBackward = moveLeft = moveRight = false;
-	moveUp = moveDown = false;
-	loseSoundPlayed = false;
-	winSoundPlayed = false;
-	startBackgroundMusic();
-	lastTick = glutGet(GLUT_ELAPSED_TIME);
+void traceCounter(const char *name, long long value) {
+	TraceRecord record = { name, nowMicros(), 0.0, value, TRACE_COUNTER };
+	traceRecord(record);
 }
 
-void setupLights() {
-	// Enhanced material properties for underwater metallic surfaces
-	GLfloat ambient[] = { 0.15f, 0.22f, 0.3f, 1.0f };
-	GLfloat diffuse[] = { 0.5f, 0.65f, 0.75f, 1.0f };
-	GLfloat specular[] = { 0.9f, 0.95f, 1.0f, 1.0f };
-	GLfloat shininess[] = { 80.0f };
-	glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, ambient);
-	glMaterialfv(GL_FRONT, GL_DIFFUSE, diffuse);
-	glMaterialfv(GL_FRONT, GL_SPECULAR, specular);
-	glMaterialfv(GL_FRONT, GL_SHININESS, shininess);
+class TraceScope {
+public:
+	TraceScope(const char *name) : name(name), start(tracer.enabled.load(std::memory_order_relaxed) ? nowMicros() : -1.0) {
+	}
 
-	// Main overhead light (cool blue-white)
-	GLfloat position0[] = { 0.0f, 1.5f, 0.0f, 1.0f };
-	GLfloat lightDiffuse0[] = { 0.6f, 0.75f, 0.95f, 1.0f };
-	GLfloat lightSpecular0[] = { 0.8f, 0.9f, 1.0f, 1.0f };
-	glLightfv(GL_LIGHT0, GL_POSITION, position0);
-	glLightfv(GL_LIGHT0, GL_DIFFUSE, lightDiffuse0);
-	glLightfv(GL_LIGHT0, GL_SPECULAR, lightSpecular0);
-	glLightf(GL_LIGHT0, GL_CONSTANT_ATTENUATION, 1.0f);
-	glLightf(GL_LIGHT0, GL_LINEAR_ATTENUATION, 0.3f);
+	~TraceScope() {
+		if (start >= 0.0) {
+			TraceRecord record = { name, start, nowMicros() - start, 0, TRACE_ZONE };
+			traceRecord(record);
+		}
+	}
 
-	// Secondary accent light (warm orange from equipment)
-	GLfloat position1[] = { -0.7f, 0.4f, -0.6f, 1.0f };
-	GLfloat lightDiffuse1[] = { 0.8f, 0.5f, 0.3f, 1.0f };
-	glLightfv(GL_LIGHT1, GL_POSITION, position1);
-	glLightfv(GL_LIGHT1, GL_DIFFUSE, lightDiffuse1);
-	glLightf(GL_LIGHT1, GL_CONSTANT_ATTENUATION, 1.0f);
-	glLightf(GL_LIGHT1, GL_LINEAR_ATTENUATION, 1.2f);
-	glLightf(GL_LIGHT1, GL_QUADRATIC_ATTENUATION, 0.5f);
-	glEnable(GL_LIGHT1);
-
-	// Underwater fog effect
-	GLfloat fogColor[] = { 0.05f, 0.15f, 0.22f, 1.0f };
-	glFogfv(GL_FOG_COLOR, fogColor);
-	glFogi(GL_FOG_MODE, GL_LINEAR);
-	glFogf(GL_FOG_START, 1.5f);
-	glFogf(GL_FOG_END, 4.0f);
-	glFogf(GL_FOG_DENSITY, 0.3f);
-	glEnable(GL_FOG);
+private:
+	const char *name;
+	double start;
+};
+
+void writeTraceEvent(const char *format, ...) {
+	fputs(tracer.firstEvent ? "\n" : ",\n", tracer.file);
+	tracer.firstEvent = false;
+	va_list args;
+	va_start(args, format);
+	vfprintf(tracer.file, format, args);
+	va_end(args);
 }
 
-void setupCamera() {
-	glMatrixMode(GL_PROJECTION);
-	glLoadIdentity();
-	gluPerspective(60.0f, 640.0f / 480.0f, 0.01f, 100.0f);
+void drainTraceRings() {
+	std::lock_guard<std::mutex> lock(tracer.ringsLock);
+	for (size_t i = 0; i < tracer.rings.size(); ++i) {
+		TraceRing &ring = *tracer.rings[i];
+		if (!ring.described) {
+			writeTraceEvent("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", ring.threadId, ring.threadName);
+			ring.described = true;
+		}
+		unsigned int h = ring.head.load(std::memory_order_relaxed);
+		unsigned int t = ring.tail.load(std::memory_order_acquire);
+		for (; h != t; ++h) {
+			const TraceRecord &record = ring.records[h % TRACE_RING_SIZE];
+			if (record.type == TRACE_ZONE) {
+				writeTraceEvent("{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}", record.name, record.start, record.duration, ring.threadId);
+			} else {
+				writeTraceEvent("{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"args\":{\"value\":%lld}}", record.name, record.start, record.value);
+			}
+		}
+		ring.head.store(h, std::memory_order_release);
+	}
+}
 
-	glMatrixMode(GL_MODELVIEW);
-	glLoadIdentity();
-	camera.look();
+void traceFlusherMain() {
+	while (tracer.flushing.load()) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		drainTraceRings();
+	}
 }
 
-void drawFloodlight(float rotation) {
-	glPushMatrix();
-	// Base plate (1)
-	glColor3f(0.18f, 0.2f, 0.22f);
-	glPushMatrix();
-	glScalef(0.18f, 0.04f, 0.18f);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	// Base corners (4)
-	glColor3f(0.15f, 0.17f, 0.19f);
-	for (int i = 0; i < 4; ++i) {
-		glPushMatrix();
-		float angle = i * 90.0f;
-		float offsetX = 0.07f * cosf(DEG2RAD(angle));
-		float offsetZ = 0.07f * sinf(DEG2RAD(angle));
-		glTranslatef(offsetX, 0.025f, offsetZ);
-		glScalef(0.03f, 0.05f, 0.03f);
-		glutSolidCube(1.0);
-		glPopMatrix();
-	}
-	// Main stand (5)
-	glColor3f(0.18f, 0.2f, 0.22f);
-	glPushMatrix();
-	glTranslatef(0.0f, 0.12f, 0.0f);
-	glScalef(0.08f, 0.24f, 0.08f);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	// Stand ring detail (6)
-	glColor3f(0.3f, 0.35f, 0.4f);
-	glPushMatrix();
-	glTranslatef(0.0f, 0.15f, 0.0f);
-	glutSolidTorus(0.015, 0.055, 12, 16);
-	glPopMatrix();
-	// Top mounting plate (7)
-	glColor3f(0.18f, 0.2f, 0.22f);
-	glPushMatrix();
-	glTranslatef(0.0f, 0.25f, 0.0f);
-	glScalef(0.14f, 0.04f, 0.14f);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	// Rotating mechanism
-	glTranslatef(0.0f, 0.27f, 0.0f);
-	glRotatef(rotation, 0.0f, 1.0f, 0.0f);
-	// Light housing (8)
-	glColor3f(0.24f, 0.3f, 0.35f);
-	glPushMatrix();
-	glScalef(0.12f, 0.06f, 0.2f);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	// Housing side vents (9-10)
-	glColor3f(0.15f, 0.2f, 0.25f);
-	glPushMatrix();
-	glTranslatef(0.065f, 0.0f, 0.05f);
-	glScalef(0.015f, 0.05f, 0.06f);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	glPushMatrix();
-	glTranslatef(-0.065f, 0.0f, 0.05f);
-	glScalef(0.015f, 0.05f, 0.06f);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	// Main lens (11)
-	glColor3f(0.65f, 0.85f, 0.9f);
-	glPushMatrix();
-	glTranslatef(0.0f, 0.01f, 0.08f);
-	glScalef(0.08f, 0.06f, 0.08f);
-	glutSolidSphere(0.8f, 20, 20);
-	glPopMatrix();
-	// Lens rim (12)
-	glColor3f(0.2f, 0.25f, 0.3f);
-	glPushMatrix();
-	glTranslatef(0.0f, 0.01f, 0.11f);
-	glRotatef(90.0f, 1.0f, 0.0f, 0.0f);
-	glutSolidTorus(0.008, 0.045, 10, 16);
-	glPopMatrix();
-	glPopMatrix();
+bool startTracing(const char *path) {
+	tracer.file = fopen(path, "w");
+	if (!tracer.file) {
+		return false;
+	}
+	fputs("{\"traceEvents\":[", tracer.file);
+	tracer.firstEvent = true;
+	tracer.enabled = true;
+	traceThreadName("main");
+	tracer.flushing = true;
+	tracer.flusher = std::thread(traceFlusherMain);
+	return true;
 }
 
-void drawAirlock(float doorPhase) {
-	float openOffset = 0.16f * (0.5f + 0.5f * sinf(doorPhase));
-	glPushMatrix();
-	// Left frame pillar (1)
-	glColor3f(0.25f, 0.3f, 0.35f);
-	glPushMatrix();
-	glTranslatef(-0.22f, 0.3f, 0.0f);
-	glScalef(0.08f, 0.6f, 0.4f);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	// Right frame pillar (2)
-	glPushMatrix();
-	glTranslatef(0.22f, 0.3f, 0.0f);
-	glScalef(0.08f, 0.6f, 0.4f);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	// Top frame (3)
-	glPushMatrix();
-	glTranslatef(0.0f, 0.6f, 0.0f);
-	glScalef(0.44f, 0.06f, 0.4f);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	// Frame reinforcement bolts (4-7)
-	glColor3f(0.4f, 0.45f, 0.5f);
-	float boltPositions[4][2] = {{-0.22f, 0.55f}, {0.22f, 0.55f}, {-0.22f, 0.05f}, {0.22f, 0.05f}};
-	for (int i = 0; i < 4; ++i) {
-		glPushMatrix();
-		glTranslatef(boltPositions[i][0], boltPositions[i][1], 0.21f);
-		glScalef(0.025f, 0.025f, 0.02f);
-		glutSolidCube(1.0);
-		glPopMatrix();
-	}
-	// Left door panel (8)
-	glColor3f(0.35f, 0.52f, 0.6f);
-	glPushMatrix();
-	glTranslatef(-openOffset, 0.3f, 0.0f);
-	glScalef(0.16f, 0.5f, 0.32f);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	// Left door window (9)
-	glColor3f(0.5f, 0.75f, 0.85f);
-	glPushMatrix();
-	glTranslatef(-openOffset, 0.35f, 0.165f);
-	glScalef(0.1f, 0.2f, 0.02f);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	// Right door panel (10)
-	glColor3f(0.35f, 0.52f, 0.6f);
-	glPushMatrix();
-	glTranslatef(openOffset, 0.3f, 0.0f);
-	glScalef(0.16f, 0.5f, 0.32f);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	// Right door window (11)
-	glColor3f(0.5f, 0.75f, 0.85f);
-	glPushMatrix();
-	glTranslatef(openOffset, 0.35f, 0.165f);
-	glScalef(0.1f, 0.2f, 0.02f);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	// Bottom seal (12)
-	glColor3f(0.18f, 0.22f, 0.26f);
-	glPushMatrix();
-	glTranslatef(0.0f, 0.05f, 0.0f);
-	glScalef(0.42f, 0.1f, 0.08f);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	// Control panel (13)
-	glColor3f(0.2f, 0.25f, 0.3f);
-	glPushMatrix();
-	glTranslatef(-0.3f, 0.25f, 0.18f);
-	glScalef(0.06f, 0.12f, 0.06f);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	// Status lights (14-15)
-	glPushMatrix();
-	glTranslatef(-0.3f, 0.3f, 0.22f);
-	glColor3f(0.2f, 0.8f, 0.3f);
-	glScalef(0.02f, 0.02f, 0.02f);
-	glutSolidSphere(1.0f, 12, 12);
-	glPopMatrix();
-	glPushMatrix();
-	glTranslatef(-0.3f, 0.27f, 0.22f);
-	glColor3f(0.9f, 0.3f, 0.2f);
-	glScalef(0.02f, 0.02f, 0.02f);
-	glutSolidSphere(1.0f, 12, 12);
-	glPopMatrix();
-	glPopMatrix();
+void stopTracing() {
+	if (!tracer.file) {
+		return;
+	}
+	tracer.enabled = false;
+	tracer.flushing = false;
+	tracer.flusher.join();
+	drainTraceRings();
+	fputs("\n],\"displayTimeUnit\":\"ms\"}\n", tracer.file);
+	fclose(tracer.file);
+	tracer.file = NULL;
+	unsigned int dropped = 0;
+	for (size_t i = 0; i < tracer.rings.size(); ++i) {
+		dropped += tracer.rings[i]->dropped.load();
+	}
+	if (dropped > 0) {
+		fprintf(stderr, "Trace dropped %u events (ring buffer full)\n", dropped);
+	}
 }
 
-void drawCoralCluster(float swayPhase) {
-	float sway = 8.0f * sinf(swayPhase);
-	glPushMatrix();
-	glColor3f(0.25f, 0.18f, 0.35f);
-	glPushMatrix();
-	glTranslatef(0.0f, 0.08f, 0.0f);
-	glScalef(0.22f, 0.04f, 0.22f);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	glColor3f(0.58f, 0.25f, 0.6f);
-	glPushMatrix();
-	glTranslatef(-0.05f, 0.18f, 0.02f);
-	glRotatef(sway, 0.0f, 0.0f, 1.0f);
-	glScalef(0.08f, 0.18f, 0.08f);
-	glutSolidSphere(1.0f, 18, 18);
-	glPopMatrix();
-	glPushMatrix();
-	glTranslatef(0.06f, 0.2f, -0.04f);
-	glRotatef(-sway * 0.6f, 0.0f, 0.0f, 1.0f);
-	glScalef(0.06f, 0.16f, 0.06f);
-	glutSolidSphere(1.0f, 18, 18);
-	glPopMatrix();
-	glPushMatrix();
-	glTranslatef(0.02f, 0.12f, 0.06f);
-	glScalef(0.05f, 0.14f, 0.05f);
-	glutSolidSphere(1.0f, 18, 18);
-	glPopMatrix();
-	glPopMatrix();
+// Render counters for the current frame. They are cheap enough to keep
+// always; finishTraceFrame emits them as trace counters and starts over.
+struct RenderCounters {
+	int drawCalls;
+	long long indices; // indices drawn; glDrawArrays counts each vertex once
+	int matrixDepth; // pushes not yet popped, both matrix stacks
+	int maxMatrixDepth;
+	int matrixOps;
+	int stateChanges;
+	int stateDropped; // state calls skipped because GL already held the value
+	int culled;       // objects and chunks rejected by the frustum test
+	int occluded;     // props skipped because last frame's query saw no samples
+	int transforms;   // part matrices rebuilt by the transform hierarchy
+};
+
+thread_local RenderCounters frameCounters; // draw workers count into their own copy
+
+// Shadow copy of the GL state the renderer sets. Capability toggles, buffer
+// and program binds, the current color, line width and light positions all
+// go through it, and a call that would set the value GL already holds is
+// dropped (and counted). Materials, light colors, fog and the projection are
+// uploaded once and sent again only after invalidateGLState or a resize.
+enum CachedFlag {
+	FLAG_UNKNOWN, // zero, so a fresh cache knows nothing
+	FLAG_OFF,
+	FLAG_ON
+};
+
+const GLenum CACHED_CAPS[] = {
+	GL_DEPTH_TEST, GL_LIGHTING, GL_NORMALIZE, GL_COLOR_MATERIAL, GL_BLEND, GL_FOG,
+	GL_LIGHT0, GL_LIGHT1, GL_LIGHT2, GL_LIGHT3, GL_LIGHT4, GL_LIGHT5, GL_LIGHT6, GL_LIGHT7
+};
+const int CACHED_CAP_COUNT = sizeof(CACHED_CAPS) / sizeof(CACHED_CAPS[0]);
+
+struct GLStateCache {
+	unsigned char caps[CACHED_CAP_COUNT]; // CachedFlag per entry of CACHED_CAPS
+	unsigned char colorArray;
+	GLint arrayBuffer; // -1 when unknown
+	GLint elementBuffer;
+	GLint program;
+	bool colorKnown;
+	GLfloat color[4];
+	GLfloat lineWidth; // 0 when unknown
+	bool lightPositionKnown[8];
+	GLfloat lightPositions[8][4]; // eye space, as GL stores them
+	bool staticLighting; // materials, light colors, attenuation and fog
+	bool projection;
+};
+
+GLStateCache glState;
+
+void invalidateGLState() {
+	memset(&glState, 0, sizeof(glState));
+	glState.arrayBuffer = glState.elementBuffer = glState.program = -1;
 }
 
-void drawConsole(float pulsePhase) {
-	float pulse = 1.0f + 0.1f * sinf(pulsePhase);
-	glPushMatrix();
-	glColor3f(0.26f, 0.32f, 0.38f);
-	glPushMatrix();
-	glScalef(0.28f, 0.12f, 0.36f);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	glPushMatrix();
-	glTranslatef(0.0f, 0.1f, -0.12f);
-	glScalef(0.24f, 0.14f, 0.14f);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	glColor3f(0.15f, 0.7f, 0.75f);
-	glPushMatrix();
-	glTranslatef(0.0f, 0.18f, -0.15f);
-	glScalef(0.28f * pulse, 0.02f, 0.14f * pulse);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	glColor3f(0.3f, 0.5f, 0.6f);
-	glPushMatrix();
-	glTranslatef(-0.08f, 0.07f, 0.15f);
-	glScalef(0.08f, 0.16f, 0.08f);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	glPushMatrix();
-	glTranslatef(0.08f, 0.07f, 0.15f);
-	glScalef(0.08f, 0.16f, 0.08f);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	glPopMatrix();
+void countDroppedState(int count) {
+	frameCounters.stateDropped += count;
 }
 
-void drawDrone(float bobPhase) {
-	float bob = 0.07f * sinf(bobPhase);
-	float spinPhase = bobPhase * 8.0f;
-	glPushMatrix();
-	glTranslatef(0.0f, 0.16f + bob, 0.0f);
-	// Main body (1)
-	glColor3f(0.65f, 0.2f, 0.3f);
-	glPushMatrix();
-	glScalef(0.16f, 0.08f, 0.16f);
-	glutSolidSphere(1.0f, 22, 22);
-	glPopMatrix();
-	// Body band detail (2)
-	glColor3f(0.5f, 0.15f, 0.25f);
-	glPushMatrix();
-	glutSolidTorus(0.012, 0.09, 12, 20);
-	glPopMatrix();
-	// Rotor arms (3-6)
-	glColor3f(0.2f, 0.22f, 0.25f);
-	glPushMatrix();
-	glTranslatef(0.14f, 0.0f, 0.0f);
-	glScalef(0.12f, 0.04f, 0.04f);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	glPushMatrix();
-	glTranslatef(-0.14f, 0.0f, 0.0f);
-	glScalef(0.12f, 0.04f, 0.04f);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	glPushMatrix();
-	glTranslatef(0.0f, 0.0f, 0.14f);
-	glScalef(0.04f, 0.04f, 0.12f);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	glPushMatrix();
-	glTranslatef(0.0f, 0.0f, -0.14f);
-	glScalef(0.04f, 0.04f, 0.12f);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	// Rotor propellers (7-10)
-	glColor3f(0.3f, 0.35f, 0.4f);
-	float rotorPos[4][2] = {{0.2f, 0.0f}, {-0.2f, 0.0f}, {0.0f, 0.2f}, {0.0f, -0.2f}};
-	for (int i = 0; i < 4; ++i) {
-		glPushMatrix();
-		glTranslatef(rotorPos[i][0], 0.02f, rotorPos[i][1]);
-		glRotatef(spinPhase * (i % 2 == 0 ? 1.0f : -1.0f), 0.0f, 1.0f, 0.0f);
-		glScalef(0.08f, 0.01f, 0.08f);
-		glutSolidCube(1.0);
-		glPopMatrix();
-	}
-	// Top sensor dome (11)
-	glColor3f(0.9f, 0.5f, 0.6f);
-	glPushMatrix();
-	glTranslatef(0.0f, 0.05f, 0.0f);
-	glScalef(0.08f, 0.02f, 0.08f);
-	glutSolidSphere(1.0f, 18, 18);
-	glPopMatrix();
-	// Front sensor (12)
-	glColor3f(0.15f, 0.7f, 0.8f);
-	glPushMatrix();
-	glTranslatef(0.0f, 0.0f, 0.09f);
-	glScalef(0.04f, 0.04f, 0.04f);
-	glutSolidSphere(1.0f, 16, 16);
-	glPopMatrix();
-	// Antenna mast (13)
-	glColor3f(0.25f, 0.28f, 0.32f);
-	glPushMatrix();
-	glTranslatef(0.0f, 0.08f, 0.0f);
-	glScalef(0.015f, 0.06f, 0.015f);
-	glutSolidCube(1.0);
-	glPopMatrix();
-	// Antenna tip (14)
-	glColor3f(0.9f, 0.7f, 0.2f);
-	glPushMatrix();
-	glTranslatef(0.0f, 0.12f, 0.0f);
-	glScalef(0.02f, 0.02f, 0.02f);
-	glutSolidSphere(1.0f, 12, 12);
-	glPopMatrix();
-	// Bottom light (15)
-	glColor3f(0.9f, 0.95f, 0.3f);
-	glPushMatrix();
-	glTranslatef(0.0f, -0.05f, 0.0f);
-	glScalef(0.025f, 0.015f, 0.025f);
-	glutSolidSphere(1.0f, 14, 14);
-	glPopMatrix();
-	glPopMatrix();
+// Applies a cached setting: false (and counted as dropped) when GL already has it
+bool updateCached(unsigned char &cached, bool on) {
+	unsigned char flag = on ? FLAG_ON : FLAG_OFF;
+	if (cached == flag) {
+		++frameCounters.stateDropped;
+		return false;
+	}
+	cached = flag;
+	++frameCounters.stateChanges;
+	return true;
 }
 
-void drawGround() {
-	glPushMatrix();
-	glTranslatef(0.0f, GROUND_Y - 0.01f, 0.0f);
-	
-	// Main seabed floor with grid pattern
-	int gridSize = 20;
-	float tileSize = (SCENE_HALF * 2.2f) / gridSize;
-	for (int i = 0; i < gridSize; ++i) {
-		for (int j = 0; j < gridSize; ++j) {
-			float x = -SCENE_HALF * 1.1f + i * tileSize;
-			float z = -SCENE_HALF * 1.1f + j * tileSize;
-			float noise = sinf(i * 0.5f) * cosf(j * 0.4f) * 0.005f;
-			
-			// Varying tile colors for depth
-			float colorVar = 0.9f + 0.1f * sinf((i + j) * 0.3f);
-			glColor3f(0.06f * colorVar, 0.14f * colorVar, 0.18f * colorVar);
-			
-			glPushMatrix();
-			glTranslatef(x + tileSize * 0.5f, noise, z + tileSize * 0.5f);
-			glBegin(GL_QUADS);
-			glNormal3f(0.0f, 1.0f, 0.0f);
-			glVertex3f(-tileSize * 0.48f, 0.0f, -tileSize * 0.48f);
-			glVertex3f(tileSize * 0.48f, 0.0f, -tileSize * 0.48f);
-			glVertex3f(tileSize * 0.48f, 0.0f, tileSize * 0.48f);
-			glVertex3f(-tileSize * 0.48f, 0.0f, tileSize * 0.48f);
-			glEnd();
-			glPopMatrix();
+bool updateCached(GLint &cached, GLint value) {
+	if (cached == value) {
+		++frameCounters.stateDropped;
+		return false;
+	}
+	cached = value;
+	++frameCounters.stateChanges;
+	return true;
+}
+
+int cachedCapSlot(GLenum cap) {
+	for (int i = 0; i < CACHED_CAP_COUNT; ++i) {
+		if (CACHED_CAPS[i] == cap) {
+			return i;
 		}
 	}
-	
-	// Grid lines for detail
-	glDisable(GL_LIGHTING);
-	glLineWidth(1.0f);
-	glColor3f(0.12f, 0.25f, 0.3f);
-	glBegin(GL_LINES);
-	for (int i = 0; i <= gridSize; ++i) {
-		float pos = -SCENE_HALF * 1.1f + i * tileSize;
-		glVertex3f(pos, 0.002f, -SCENE_HALF * 1.1f);
-		glVertex3f(pos, 0.002f, SCENE_HALF * 1.1f);
-		glVertex3f(-SCENE_HALF * 1.1f, 0.002f, pos);
-		glVertex3f(SCENE_HALF * 1.1f, 0.002f, pos);
-	}
-	glEnd();
-	glEnable(GL_LIGHTING);
-	
-	glPopMatrix();
+	return -1;
 }
 
-void drawWallPanel(float width, float height, float colorPhase) {
-	float r = 0.18f + 0.12f * sinf(colorPhase);
-	float g = 0.38f + 0.18f * sinf(colorPhase + 2.094f);
-	float b = 0.52f + 0.18f * sinf(colorPhase + 4.188f);
-	
-	int panels = 5;
-	float panelWidth = width / panels;
-	float panelHeight = height / 3.0f;
-	
-	for (int row = 0; row < 3; ++row) {
-		for (int col = 0; col < panels; ++col) {
-			float px = -width * 0.5f + col * panelWidth + panelWidth * 0.5f;
+void bindArrayBuffer(GLuint buffer) {
+	if (updateCached(glState.arrayBuffer, (GLint)buffer)) {
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	}
+}
+
+void bindElementBuffer(GLuint buffer) {
+	if (updateCached(glState.elementBuffer, (GLint)buffer)) {
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+	}
+}
+
+void useProgram(GLuint program) {
+	if (updateCached(glState.program, (GLint)program)) {
+		glUseProgram(program);
+	}
+}
+
+// GL leaves the current color undefined after drawing with a color array
+void setColorArray(bool on) {
+	if (updateCached(glState.colorArray, on)) {
+		if (on) {
+			glEnableClientState(GL_COLOR_ARRAY);
+		} else {
+			glDisableClientState(GL_COLOR_ARRAY);
+		}
+	}
+	if (on) {
+		glState.colorKnown = false;
+	}
+}
+
+void setLineWidth(GLfloat width) {
+	if (glState.lineWidth == width) {
+		++frameCounters.stateDropped;
+		return;
+	}
+	glState.lineWidth = width;
+	glLineWidth(width);
+	++frameCounters.stateChanges;
+}
+
+// Render queue. While the props, goals and player are drawn the queue is
+// recording: the matrix, color and lighting wrappers below update CPU-side
+// state instead of GL, and every mesh draw becomes a packet carrying its
+// model matrix, color and lighting flag. executeRenderQueue then sorts the
+// packets by key and submits them: opaque ones grouped by lighting and mesh,
+// nearest first within a group, then transparent ones farthest first. Outside
+// recording the wrappers go straight to GL.
+struct Mesh;
+
+struct RenderPacket {
+	unsigned long long key;
+	const Mesh *mesh;
+	float model[16];
+	float color[4];
+	bool lighting;
+};
+
+const int RENDER_QUEUE_STACK_DEPTH = 32;
+
+struct RenderQueue {
+	bool recording;
+	std::vector<RenderPacket> packets;
+	float matrix[16]; // current model matrix, world space
+	float stack[RENDER_QUEUE_STACK_DEPTH][16];
+	int depth;
+	float color[4];
+	bool lighting;
+};
+
+thread_local RenderQueue renderQueue; // each draw worker records into its own
+
+void identityMatrix(float out[16]) {
+	for (int i = 0; i < 16; ++i) {
+		out[i] = (i % 5 == 0) ? 1.0f : 0.0f;
+	}
+}
+
+void pushMatrix() {
+	if (renderQueue.recording) {
+		if (renderQueue.depth < RENDER_QUEUE_STACK_DEPTH) {
+			memcpy(renderQueue.stack[renderQueue.depth], renderQueue.matrix, sizeof(renderQueue.matrix));
+		}
+		++renderQueue.depth;
+		return;
+	}
+	glPushMatrix();
+	++frameCounters.matrixOps;
+	frameCounters.maxMatrixDepth = std::max(frameCounters.maxMatrixDepth, ++frameCounters.matrixDepth);
+}
+
+void popMatrix() {
+	if (renderQueue.recording) {
+		if (--renderQueue.depth < RENDER_QUEUE_STACK_DEPTH && renderQueue.depth >= 0) {
+			memcpy(renderQueue.matrix, renderQueue.stack[renderQueue.depth], sizeof(renderQueue.matrix));
+		}
+		return;
+	}
+	glPopMatrix();
+	++frameCounters.matrixOps;
+	--frameCounters.matrixDepth;
+}
+
+// Post-multiplies m in place, as glTranslatef, glScalef and glRotatef do
+void applyTranslation(float m[16], float x, float y, float z) {
+	for (int r = 0; r < 3; ++r) {
+		m[12 + r] += m[r] * x + m[4 + r] * y + m[8 + r] * z;
+	}
+}
+
+void applyScale(float m[16], float x, float y, float z) {
+	for (int r = 0; r < 3; ++r) {
+		m[r] *= x;
+		m[4 + r] *= y;
+		m[8 + r] *= z;
+	}
+}
+
+// `angle` degrees about the axis (x, y, z)
+void applyRotation(float m[16], float angle, float x, float y, float z) {
+	float length = sqrtf(x * x + y * y + z * z);
+	if (length == 0.0f) {
+		return;
+	}
+	x /= length;
+	y /= length;
+	z /= length;
+	float c = cosf(angle * 0.0174532925f);
+	float s = sinf(angle * 0.0174532925f);
+	float t = 1.0f - c;
+	float rotation[16] = {
+		t * x * x + c, t * x * y + s * z, t * x * z - s * y, 0.0f,
+		t * x * y - s * z, t * y * y + c, t * y * z + s * x, 0.0f,
+		t * x * z + s * y, t * y * z - s * x, t * z * z + c, 0.0f,
+		0.0f, 0.0f, 0.0f, 1.0f
+	};
+	float result[16];
+	multiplyMatrix(m, rotation, result);
+	memcpy(m, result, sizeof(result));
+}
+
+void translateMatrix(float x, float y, float z) {
+	if (!renderQueue.recording) {
+		glTranslatef(x, y, z);
+		return;
+	}
+	applyTranslation(renderQueue.matrix, x, y, z);
+}
+
+void scaleMatrix(float x, float y, float z) {
+	if (!renderQueue.recording) {
+		glScalef(x, y, z);
+		return;
+	}
+	applyScale(renderQueue.matrix, x, y, z);
+}
+
+void rotateMatrix(float angle, float x, float y, float z) {
+	if (!renderQueue.recording) {
+		glRotatef(angle, x, y, z);
+		return;
+	}
+	applyRotation(renderQueue.matrix, angle, x, y, z);
+}
+
+void setDrawColor(float r, float g, float b, float a = 1.0f) {
+	if (!renderQueue.recording) {
+		if (glState.colorKnown && glState.color[0] == r && glState.color[1] == g && glState.color[2] == b && glState.color[3] == a) {
+			++frameCounters.stateDropped;
+			return;
+		}
+		glState.colorKnown = true;
+		glState.color[0] = r;
+		glState.color[1] = g;
+		glState.color[2] = b;
+		glState.color[3] = a;
+		glColor4f(r, g, b, a);
+		return;
+	}
+	renderQueue.color[0] = r;
+	renderQueue.color[1] = g;
+	renderQueue.color[2] = b;
+	renderQueue.color[3] = a;
+}
+
+// While recording only GL_LIGHTING is tracked per packet; the recorded draw
+// code toggles nothing else
+void enableCap(GLenum cap) {
+	if (renderQueue.recording) {
+		renderQueue.lighting = renderQueue.lighting || cap == GL_LIGHTING;
+		return;
+	}
+	int slot = cachedCapSlot(cap);
+	if (slot < 0) {
+		glEnable(cap);
+		++frameCounters.stateChanges;
+	} else if (updateCached(glState.caps[slot], true)) {
+		glEnable(cap);
+	}
+}
+
+void disableCap(GLenum cap) {
+	if (renderQueue.recording) {
+		renderQueue.lighting = renderQueue.lighting && cap != GL_LIGHTING;
+		return;
+	}
+	int slot = cachedCapSlot(cap);
+	if (slot < 0) {
+		glDisable(cap);
+		++frameCounters.stateChanges;
+	} else if (updateCached(glState.caps[slot], false)) {
+		glDisable(cap);
+	}
+}
+
+void countStateChanges(int count) {
+	frameCounters.stateChanges += count;
+}
+
+RenderCounters lastFrameCounters;
+
+void countDraw(long long indices) {
+	++frameCounters.drawCalls;
+	frameCounters.indices += indices;
+}
+
+void finishTraceFrame() {
+	if (tracer.enabled.load(std::memory_order_relaxed)) {
+		traceCounter("draw_calls", frameCounters.drawCalls);
+		traceCounter("indices", frameCounters.indices);
+		traceCounter("matrix_depth_max", frameCounters.maxMatrixDepth);
+		traceCounter("matrix_push_pop", frameCounters.matrixOps);
+		traceCounter("state_changes", frameCounters.stateChanges);
+		traceCounter("state_dropped", frameCounters.stateDropped);
+		traceCounter("objects_culled", frameCounters.culled);
+		traceCounter("objects_occluded", frameCounters.occluded);
+		traceCounter("transforms", frameCounters.transforms);
+	}
+	lastFrameCounters = frameCounters;
+	int depth = frameCounters.matrixDepth;
+	frameCounters = RenderCounters();
+	frameCounters.matrixDepth = frameCounters.maxMatrixDepth = depth;
+}
+
+// Headless runs have no GLUT window, so the few GLUT calls reachable from
+// Display() and resetGame() go through these.
+bool headless = false;
+
+int elapsedMillis() {
+	if (headless) {
+		return (int)nowMillis();
+	}
+	return glutGet(GLUT_ELAPSED_TIME);
+}
+
+void presentFrame() {
+	if (headless) {
+		glFinish();
+	} else {
+		glutSwapBuffers();
+	}
+}
+
+unsigned int readLittleEndian(const unsigned char *bytes, int count) {
+	unsigned int value = 0;
+	for (int i = count - 1; i >= 0; --i) {
+		value = (value << 8) | bytes[i];
+	}
+	return value;
+}
+
+void writeLittleEndian(FILE *file, unsigned int value, int bytes) {
+	for (int i = 0; i < bytes; ++i) {
+		fputc((value >> (8 * i)) & 0xff, file);
+	}
+}
+
+// Audio engine: clips are decoded once into float stereo at the mixer rate,
+// the game thread posts commands through a lock-free queue and the audio
+// thread mixes the playing voices into the output backend.
+const int AUDIO_RATE = 44100;
+const int AUDIO_BLOCK_FRAMES = 512;
+const int AUDIO_MAX_VOICES = 16;
+const unsigned int AUDIO_QUEUE_SIZE = 64;
+
+enum AudioBackend {
+	AUDIO_BACKEND_NULL,
+	AUDIO_BACKEND_WAV,
+	AUDIO_BACKEND_DEVICE
+};
+
+enum AudioTag {
+	AUDIO_TAG_EFFECT,
+	AUDIO_TAG_MUSIC
+};
+
+enum AudioCommandType {
+	AUDIO_PLAY,
+	AUDIO_STOP
+};
+
+struct AudioClip {
+	std::vector<float> samples; // interleaved stereo at AUDIO_RATE
+	size_t frames;
+};
+
+struct AudioCommand {
+	AudioCommandType type;
+	const AudioClip *clip;
+	int tag; // AUDIO_STOP silences every voice started with this tag
+	bool loop;
+};
+
+struct AudioVoice {
+	const AudioClip *clip; // NULL when the voice is free
+	size_t position;
+	int tag;
+	bool loop;
+};
+
+// Single producer (game thread), single consumer (audio thread)
+struct AudioCommandQueue {
+	AudioCommand slots[AUDIO_QUEUE_SIZE];
+	std::atomic<unsigned int> head; // next slot to read
+	std::atomic<unsigned int> tail; // next slot to write
+
+	bool push(const AudioCommand &command) {
+		unsigned int t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == AUDIO_QUEUE_SIZE) {
+			return false;
+		}
+		slots[t % AUDIO_QUEUE_SIZE] = command;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(AudioCommand &command) {
+		unsigned int h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire)) {
+			return false;
+		}
+		command = slots[h % AUDIO_QUEUE_SIZE];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+};
+
+struct AudioEngine {
+	bool started;
+	AudioBackend backend;
+	AudioCommandQueue commands;
+	AudioVoice voices[AUDIO_MAX_VOICES]; // touched only by the audio thread
+	std::atomic<bool> running;
+	std::thread thread;
+	FILE *wavFile;
+	unsigned int wavFrames;
+#if defined(__APPLE__)
+	AudioQueueRef queue;
+#endif
+};
+
+AudioEngine audio;
+
+// Asset registry: sound files are mapped and decoded once on a loader thread
+// during startup. A handle turns ready when its clip is published; before that,
+// or if the file is missing, playing it does nothing.
+struct SoundAssetSlot {
+	const char *path;
+	AudioClip clip;
+	std::atomic<bool> ready;
+	double loadMillis;
+};
+
+struct AssetRegistry {
+	SoundAssetSlot sounds[SOUND_ASSET_COUNT];
+	std::thread loader;
+	bool musicPending; // music was asked for before its clip was ready
+};
+
+AssetRegistry assets;
+
+bool readFile(const char *path, std::vector<unsigned char> &data) {
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	data.resize(size > 0 ? size : 0);
+	bool ok = size > 0 && fread(&data[0], 1, data.size(), file) == data.size();
+	fclose(file);
+	return ok;
+}
+
+float decodeSample(const unsigned char *p, int format, int bits) {
+	if (format == 3) {
+		float value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+	switch (bits) {
+	case 8:
+		return (p[0] - 128) / 128.0f;
+	case 16:
+		return (short)readLittleEndian(p, 2) / 32768.0f;
+	case 24:
+		return ((int)(readLittleEndian(p, 3) << 8) >> 8) / 8388608.0f;
+	default:
+		return (int)readLittleEndian(p, 4) / 2147483648.0f;
+	}
+}
+
+// Parses a RIFF/WAVE image (PCM 8/16/24/32 or float 32) and resamples it
+// to stereo at AUDIO_RATE.
+bool decodeWav(const unsigned char *data, size_t size, AudioClip &clip) {
+	if (size < 12 || memcmp(data, "RIFF", 4) != 0 || memcmp(data + 8, "WAVE", 4) != 0) {
+		return false;
+	}
+	int format = 0, channels = 0, bits = 0;
+	unsigned int rate = 0;
+	const unsigned char *pcm = NULL;
+	size_t pcmBytes = 0;
+	size_t offset = 12;
+	while (offset + 8 <= size) {
+		const unsigned char *chunk = data + offset;
+		size_t chunkSize = std::min((size_t)readLittleEndian(chunk + 4, 4), size - offset - 8);
+		if (memcmp(chunk, "fmt ", 4) == 0 && chunkSize >= 16) {
+			format = readLittleEndian(chunk + 8, 2);
+			channels = readLittleEndian(chunk + 10, 2);
+			rate = readLittleEndian(chunk + 12, 4);
+			bits = readLittleEndian(chunk + 22, 2);
+			if (format == 0xFFFE && chunkSize >= 26) {
+				format = readLittleEndian(chunk + 32, 2); // WAVE_FORMAT_EXTENSIBLE sub-format
+			}
+		} else if (memcmp(chunk, "data", 4) == 0) {
+			pcm = chunk + 8;
+			pcmBytes = chunkSize;
+		}
+		offset += 8 + chunkSize + (chunkSize & 1);
+	}
+	bool supported = (format == 1 && (bits == 8 || bits == 16 || bits == 24 || bits == 32))
+		|| (format == 3 && bits == 32);
+	if (!pcm || !supported || channels < 1 || rate == 0) {
+		return false;
+	}
+	int frameBytes = channels * bits / 8;
+	size_t sourceFrames = pcmBytes / frameBytes;
+	if (sourceFrames == 0) {
+		return false;
+	}
+	clip.frames = (size_t)((double)sourceFrames * AUDIO_RATE / rate);
+	clip.samples.resize(clip.frames * 2);
+	int right = channels > 1 ? 1 : 0;
+	for (size_t i = 0; i < clip.frames; ++i) {
+		double source = (double)i * rate / AUDIO_RATE;
+		size_t index = (size_t)source;
+		size_t nextIndex = std::min(index + 1, sourceFrames - 1);
+		float t = (float)(source - index);
+		const unsigned char *a = pcm + index * frameBytes;
+		const unsigned char *b = pcm + nextIndex * frameBytes;
+		for (int c = 0; c < 2; ++c) {
+			int channel = c == 0 ? 0 : right;
+			float sa = decodeSample(a + channel * bits / 8, format, bits);
+			float sb = decodeSample(b + channel * bits / 8, format, bits);
+			clip.samples[i * 2 + c] = sa + (sb - sa) * t;
+		}
+	}
+	return true;
+}
+
+#if defined(__APPLE__)
+AudioStreamBasicDescription mixerFormat() {
+	AudioStreamBasicDescription format;
+	memset(&format, 0, sizeof(format));
+	format.mSampleRate = AUDIO_RATE;
+	format.mFormatID = kAudioFormatLinearPCM;
+	format.mFormatFlags = kAudioFormatFlagIsFloat | kAudioFormatFlagIsPacked;
+	format.mBytesPerPacket = 2 * sizeof(float);
+	format.mFramesPerPacket = 1;
+	format.mBytesPerFrame = 2 * sizeof(float);
+	format.mChannelsPerFrame = 2;
+	format.mBitsPerChannel = 32;
+	return format;
+}
+
+// Core Audio converts anything it can open (the soundtrack is an MP3)
+bool decodeWithCoreAudio(const char *path, AudioClip &clip) {
+	CFURLRef url = CFURLCreateFromFileSystemRepresentation(NULL, (const UInt8 *)path, strlen(path), false);
+	ExtAudioFileRef file = NULL;
+	OSStatus status = ExtAudioFileOpenURL(url, &file);
+	CFRelease(url);
+	if (status != noErr) {
+		return false;
+	}
+	AudioStreamBasicDescription format = mixerFormat();
+	if (ExtAudioFileSetProperty(file, kExtAudioFileProperty_ClientDataFormat, sizeof(format), &format) != noErr) {
+		ExtAudioFileDispose(file);
+		return false;
+	}
+	clip.samples.clear();
+	float block[AUDIO_BLOCK_FRAMES * 2];
+	for (;;) {
+		AudioBufferList buffers;
+		buffers.mNumberBuffers = 1;
+		buffers.mBuffers[0].mNumberChannels = 2;
+		buffers.mBuffers[0].mDataByteSize = sizeof(block);
+		buffers.mBuffers[0].mData = block;
+		UInt32 frames = AUDIO_BLOCK_FRAMES;
+		if (ExtAudioFileRead(file, &frames, &buffers) != noErr || frames == 0) {
+			break;
+		}
+		clip.samples.insert(clip.samples.end(), block, block + frames * 2);
+	}
+	ExtAudioFileDispose(file);
+	clip.frames = clip.samples.size() / 2;
+	return clip.frames > 0;
+}
+#endif
+
+struct MappedFile {
+	const unsigned char *data;
+	size_t size;
+	std::vector<unsigned char> buffer; // used where mmap is unavailable
+};
+
+bool mapFile(const char *path, MappedFile &file) {
+#if defined(_WIN32)
+	if (!readFile(path, file.buffer)) {
+		return false;
+	}
+	file.data = &file.buffer[0];
+	file.size = file.buffer.size();
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat info;
+	void *data = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && info.st_size > 0) {
+		data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	file.data = (const unsigned char *)data;
+	file.size = info.st_size;
+#endif
+	return true;
+}
+
+void unmapFile(MappedFile &file) {
+#if !defined(_WIN32)
+	munmap((void *)file.data, file.size);
+#endif
+	file.data = NULL;
+	file.size = 0;
+}
+
+bool decodeClip(const char *path, AudioClip &clip) {
+	TraceScope trace("decodeClip");
+	MappedFile file;
+	if (!mapFile(path, file)) {
+		return false;
+	}
+	bool decoded = decodeWav(file.data, file.size, clip);
+	unmapFile(file);
+#if defined(__APPLE__)
+	if (!decoded) {
+		decoded = decodeWithCoreAudio(path, clip);
+	}
+#endif
+	if (!decoded) {
+		fprintf(stderr, "Cannot decode %s\n", path);
+	}
+	return decoded;
+}
+
+void loadSoundAssets() {
+	traceThreadName("asset loader");
+	for (int i = 0; i < SOUND_ASSET_COUNT; ++i) {
+		SoundAssetSlot &slot = assets.sounds[i];
+		double start = nowMillis();
+		bool decoded = decodeClip(slot.path, slot.clip);
+		slot.loadMillis = nowMillis() - start;
+		if (decoded) {
+			slot.ready.store(true, std::memory_order_release);
+			printf("Loaded %s in %.1f ms\n", slot.path, slot.loadMillis);
+		}
+	}
+}
+
+// Null until the loader has published the clip
+const AudioClip *soundClip(SoundAsset asset) {
+	SoundAssetSlot &slot = assets.sounds[asset];
+	return slot.ready.load(std::memory_order_acquire) ? &slot.clip : NULL;
+}
+
+void mixAudio(float *out, int frames) {
+	TraceScope trace("mixAudio");
+	AudioCommand command;
+	while (audio.commands.pop(command)) {
+		for (int i = 0; i < AUDIO_MAX_VOICES; ++i) {
+			AudioVoice &voice = audio.voices[i];
+			if (command.type == AUDIO_STOP && voice.clip && voice.tag == command.tag) {
+				voice.clip = NULL;
+			} else if (command.type == AUDIO_PLAY && !voice.clip) {
+				voice.clip = command.clip;
+				voice.position = 0;
+				voice.tag = command.tag;
+				voice.loop = command.loop;
+				break;
+			}
+		}
+	}
+	memset(out, 0, frames * 2 * sizeof(float));
+	for (int i = 0; i < AUDIO_MAX_VOICES; ++i) {
+		AudioVoice &voice = audio.voices[i];
+		for (int f = 0; f < frames && voice.clip; ++f) {
+			if (voice.position >= voice.clip->frames) {
+				if (!voice.loop) {
+					voice.clip = NULL;
+					break;
+				}
+				voice.position = 0;
+			}
+			out[f * 2] += voice.clip->samples[voice.position * 2];
+			out[f * 2 + 1] += voice.clip->samples[voice.position * 2 + 1];
+			++voice.position;
+		}
+	}
+	for (int i = 0; i < frames * 2; ++i) {
+		out[i] = std::max(-1.0f, std::min(1.0f, out[i]));
+	}
+}
+
+void writeWavHeader(FILE *file, unsigned int frames) {
+	unsigned int dataBytes = frames * 4;
+	fwrite("RIFF", 1, 4, file);
+	writeLittleEndian(file, 36 + dataBytes, 4);
+	fwrite("WAVEfmt ", 1, 8, file);
+	writeLittleEndian(file, 16, 4);
+	writeLittleEndian(file, 1, 2); // PCM
+	writeLittleEndian(file, 2, 2);
+	writeLittleEndian(file, AUDIO_RATE, 4);
+	writeLittleEndian(file, AUDIO_RATE * 4, 4);
+	writeLittleEndian(file, 4, 2);
+	writeLittleEndian(file, 16, 2);
+	fwrite("data", 1, 4, file);
+	writeLittleEndian(file, dataBytes, 4);
+}
+
+// Null and WAV backends pace themselves against the wall clock so clips
+// play out at the same speed a sound device would consume them.
+void audioThreadMain() {
+	float block[AUDIO_BLOCK_FRAMES * 2];
+	short pcm[AUDIO_BLOCK_FRAMES * 2];
+	traceThreadName("audio");
+	std::chrono::microseconds period(AUDIO_BLOCK_FRAMES * 1000000LL / AUDIO_RATE);
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now();
+	while (audio.running.load()) {
+		mixAudio(block, AUDIO_BLOCK_FRAMES);
+		if (audio.wavFile) {
+			for (int i = 0; i < AUDIO_BLOCK_FRAMES * 2; ++i) {
+				pcm[i] = (short)(block[i] * 32767.0f);
+			}
+			// the file is little-endian like every platform this builds on
+			fwrite(pcm, sizeof(short), AUDIO_BLOCK_FRAMES * 2, audio.wavFile);
+			audio.wavFrames += AUDIO_BLOCK_FRAMES;
+		}
+		deadline += period;
+		std::this_thread::sleep_until(deadline);
+	}
+}
+
+#if defined(__APPLE__)
+void audioQueueCallback(void *, AudioQueueRef queue, AudioQueueBufferRef buffer) {
+	mixAudio((float *)buffer->mAudioData, AUDIO_BLOCK_FRAMES);
+	buffer->mAudioDataByteSize = AUDIO_BLOCK_FRAMES * 2 * sizeof(float);
+	AudioQueueEnqueueBuffer(queue, buffer, 0, NULL);
+}
+
+// The queue calls back on its own thread, which then acts as the audio thread
+bool startDeviceOutput() {
+	AudioStreamBasicDescription format = mixerFormat();
+	if (AudioQueueNewOutput(&format, audioQueueCallback, NULL, NULL, NULL, 0, &audio.queue) != noErr) {
+		return false;
+	}
+	for (int i = 0; i < 3; ++i) {
+		AudioQueueBufferRef buffer;
+		if (AudioQueueAllocateBuffer(audio.queue, AUDIO_BLOCK_FRAMES * 2 * sizeof(float), &buffer) != noErr) {
+			AudioQueueDispose(audio.queue, true);
+			return false;
+		}
+		audioQueueCallback(NULL, audio.queue, buffer);
+	}
+	if (AudioQueueStart(audio.queue, NULL) != noErr) {
+		AudioQueueDispose(audio.queue, true);
+		return false;
+	}
+	return true;
+}
+#endif
+
+bool initAudio(AudioBackend backend, const char *wavPath) {
+	audio.backend = backend;
+	if (backend == AUDIO_BACKEND_WAV) {
+		audio.wavFile = fopen(wavPath, "wb");
+		if (!audio.wavFile) {
+			return false;
+		}
+		writeWavHeader(audio.wavFile, 0);
+	}
+#if defined(__APPLE__)
+	if (backend == AUDIO_BACKEND_DEVICE) {
+		if (!startDeviceOutput()) {
+			fprintf(stderr, "No audio device, sound is muted\n");
+			audio.backend = AUDIO_BACKEND_NULL;
+		} else {
+			audio.started = true;
+			return true;
+		}
+	}
+#else
+	if (backend == AUDIO_BACKEND_DEVICE) {
+		audio.backend = AUDIO_BACKEND_NULL;
+	}
+#endif
+	audio.running = true;
+	audio.thread = std::thread(audioThreadMain);
+	audio.started = true;
+	return true;
+}
+
+void shutdownAudio() {
+	if (assets.loader.joinable()) {
+		assets.loader.join();
+	}
+	if (!audio.started) {
+		return;
+	}
+	audio.started = false;
+#if defined(__APPLE__)
+	if (audio.backend == AUDIO_BACKEND_DEVICE) {
+		AudioQueueStop(audio.queue, true);
+		AudioQueueDispose(audio.queue, true);
+		return;
+	}
+#endif
+	audio.running = false;
+	audio.thread.join();
+	if (audio.wavFile) {
+		fseek(audio.wavFile, 0, SEEK_SET);
+		writeWavHeader(audio.wavFile, audio.wavFrames);
+		fclose(audio.wavFile);
+		audio.wavFile = NULL;
+	}
+}
+
+void playClip(const AudioClip *clip, int tag, bool loop) {
+	if (!audio.started || !clip) {
+		return;
+	}
+	AudioCommand command = { AUDIO_PLAY, clip, tag, loop };
+	audio.commands.push(command);
+}
+
+void stopClips(int tag) {
+	if (!audio.started) {
+		return;
+	}
+	AudioCommand command = { AUDIO_STOP, NULL, tag, false };
+	audio.commands.push(command);
+}
+
+// Returns immediately; the clips become playable as the loader finishes them
+void loadAudioAssets() {
+	assets.sounds[SOUND_ASSET_MUSIC].path = SOUND_TRACK;
+	assets.sounds[SOUND_ASSET_SERVO].path = SOUND_SERVO;
+	assets.sounds[SOUND_ASSET_GOAL].path = SOUND_GOAL;
+	assets.sounds[SOUND_ASSET_BUZZER].path = SOUND_BUZZER;
+	assets.loader = std::thread(loadSoundAssets);
+}
+
+void playEffect(SoundAsset asset) {
+	playClip(soundClip(asset), AUDIO_TAG_EFFECT, false);
+}
+
+void stopBackgroundMusic() {
+	assets.musicPending = false;
+	stopClips(AUDIO_TAG_MUSIC);
+}
+
+void startBackgroundMusic() {
+	stopBackgroundMusic();
+	const AudioClip *clip = soundClip(SOUND_ASSET_MUSIC);
+	if (clip) {
+		playClip(clip, AUDIO_TAG_MUSIC, true);
+	} else {
+		assets.musicPending = true;
+	}
+}
+
+// Starts music that was requested while the soundtrack was still decoding
+void pollAudioAssets() {
+	if (assets.musicPending && soundClip(SOUND_ASSET_MUSIC)) {
+		startBackgroundMusic();
+	}
+}
+
+const char *PROP_MODEL_NAMES[MODEL_COUNT] = { "floodlight", "airlock", "coral", "console", "drone" };
+
+// Checks that a record array lies inside the file and is aligned for use in place
+bool sceneRangeValid(const MappedFile &file, unsigned int offset, unsigned int count, size_t recordSize) {
+	return offset % 4 == 0 && offset <= file.size && count <= (file.size - offset) / recordSize;
+}
+
+// Arena limits shared by the compiler and the loader; also false for NaN
+bool sceneArenaValid(float half, float maxHeight) {
+	return half >= MIN_SCENE_HALF && half <= MAX_SCENE_HALF && maxHeight >= MIN_SCENE_HEIGHT && maxHeight <= MAX_SCENE_HEIGHT;
+}
+
+// Prop and goal positions must lie inside the arena, between the floor and
+// the ceiling; the comparisons also reject NaN and infinities
+bool scenePointValid(float x, float y, float z, float half, float maxHeight) {
+	return fabsf(x) <= half && fabsf(z) <= half && y >= 0.0f && y <= maxHeight;
+}
+
+// Lights may sit outside the arena, but every value has to be finite and the
+// attenuation non-negative, as GL requires
+bool sceneLightValid(const SceneLightRecord &light) {
+	const float *values[] = { light.position, light.diffuse, light.specular };
+	for (int v = 0; v < 3; ++v) {
+		for (int i = 0; i < 4; ++i) {
+			if (!isfinite(values[v][i])) {
+				return false;
+			}
+		}
+	}
+	for (int i = 0; i < 3; ++i) {
+		if (!isfinite(light.attenuation[i]) || light.attenuation[i] < 0.0f) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Checks every record against the arena; `what` names the first bad entry
+bool sceneRecordsValid(float half, float maxHeight, const ScenePropRecord *props, unsigned int propCount,
+	const SceneGoalRecord *goals, unsigned int goalCount, const SceneLightRecord *lights, unsigned int lightCount, const char *&what) {
+	for (unsigned int i = 0; i < propCount; ++i) {
+		if (props[i].model >= MODEL_COUNT || !scenePointValid(props[i].x, props[i].y, props[i].z, half, maxHeight)) {
+			what = "prop";
+			return false;
+		}
+	}
+	for (unsigned int i = 0; i < goalCount; ++i) {
+		if (!scenePointValid(goals[i].x, goals[i].y, goals[i].z, half, maxHeight)) {
+			what = "goal";
+			return false;
+		}
+	}
+	for (unsigned int i = 0; i < lightCount; ++i) {
+		if (!sceneLightValid(lights[i])) {
+			what = "light";
+			return false;
+		}
+	}
+	return true;
+}
+
+// Maps a compiled scene and points `scene` at its records. The mapping stays
+// alive for the rest of the run.
+bool loadScene(const char *path) {
+	double start = nowMillis();
+	MappedFile file;
+	if (!mapFile(path, file)) {
+		fprintf(stderr, "Cannot open scene %s\n", path);
+		return false;
+	}
+	const SceneFileHeader *header = (const SceneFileHeader *)file.data;
+	bool valid = file.size >= sizeof(SceneFileHeader)
+		&& memcmp(header->magic, "ARSC", 4) == 0
+		&& header->version == SCENE_FILE_VERSION
+		&& sceneArenaValid(header->half, header->maxHeight)
+		&& header->lightCount <= (unsigned int)MAX_SCENE_LIGHTS
+		&& sceneRangeValid(file, header->propOffset, header->propCount, sizeof(ScenePropRecord))
+		&& sceneRangeValid(file, header->goalOffset, header->goalCount, sizeof(SceneGoalRecord))
+		&& sceneRangeValid(file, header->lightOffset, header->lightCount, sizeof(SceneLightRecord));
+	if (!valid) {
+		fprintf(stderr, "%s is not a version %u scene file\n", path, SCENE_FILE_VERSION);
+		unmapFile(file);
+		return false;
+	}
+	const ScenePropRecord *props = (const ScenePropRecord *)(file.data + header->propOffset);
+	const SceneGoalRecord *goals = (const SceneGoalRecord *)(file.data + header->goalOffset);
+	const SceneLightRecord *lights = (const SceneLightRecord *)(file.data + header->lightOffset);
+	const char *what = NULL;
+	if (!sceneRecordsValid(header->half, header->maxHeight, props, header->propCount, goals, header->goalCount, lights, header->lightCount, what)) {
+		fprintf(stderr, "%s has a %s outside the arena or with invalid values\n", path, what);
+		unmapFile(file);
+		return false;
+	}
+	scene.half = header->half;
+	scene.maxHeight = header->maxHeight;
+	scene.props = props;
+	scene.propCount = header->propCount;
+	scene.goals = goals;
+	scene.goalCount = header->goalCount;
+	scene.lights = lights;
+	scene.lightCount = header->lightCount;
+	fprintf(stderr, "Loaded scene %s (%u props, %u goals, %u lights) in %.2f ms\n", path, scene.propCount, scene.goalCount, scene.lightCount, nowMillis() - start);
+	return true;
+}
+
+// Text scene format, one entry per line ('#' starts a comment):
+//   arena <half> <maxHeight>
+//   prop <floodlight|airlock|coral|console|drone> <x> <y> <z>
+//   goal <x> <y> <z>
+//   light <px> <py> <pz> <pw> <dr> <dg> <db> <sr> <sg> <sb> <constant> <linear> <quadratic>
+int compileScene(const char *textPath, const char *binaryPath) {
+	FILE *in = fopen(textPath, "r");
+	if (!in) {
+		fprintf(stderr, "Cannot read %s\n", textPath);
+		return EXIT_FAILURE;
+	}
+	SceneFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "ARSC", 4);
+	header.version = SCENE_FILE_VERSION;
+	header.half = 1.0f;
+	header.maxHeight = 0.85f;
+	std::vector<ScenePropRecord> props;
+	std::vector<SceneGoalRecord> goals;
+	std::vector<SceneLightRecord> lights;
+	char line[512];
+	int lineNumber = 0;
+	bool ok = true;
+	while (ok && fgets(line, sizeof(line), in)) {
+		++lineNumber;
+		char *comment = strchr(line, '#');
+		if (comment) {
+			*comment = '\0';
+		}
+		char kind[32], model[32];
+		if (sscanf(line, "%31s", kind) != 1) {
+			continue;
+		}
+		if (strcmp(kind, "arena") == 0) {
+			ok = sscanf(line, "%*s %f %f", &header.half, &header.maxHeight) == 2 && sceneArenaValid(header.half, header.maxHeight);
+		} else if (strcmp(kind, "prop") == 0) {
+			ScenePropRecord prop;
+			ok = sscanf(line, "%*s %31s %f %f %f", model, &prop.x, &prop.y, &prop.z) == 4;
+			prop.model = MODEL_COUNT;
+			for (int m = 0; m < MODEL_COUNT; ++m) {
+				if (strcmp(model, PROP_MODEL_NAMES[m]) == 0) {
+					prop.model = m;
+				}
+			}
+			ok = ok && prop.model < MODEL_COUNT;
+			props.push_back(prop);
+		} else if (strcmp(kind, "goal") == 0) {
+			SceneGoalRecord goal;
+			ok = sscanf(line, "%*s %f %f %f", &goal.x, &goal.y, &goal.z) == 3;
+			goals.push_back(goal);
+		} else if (strcmp(kind, "light") == 0) {
+			SceneLightRecord light;
+			light.diffuse[3] = light.specular[3] = 1.0f;
+			ok = sscanf(line, "%*s %f %f %f %f %f %f %f %f %f %f %f %f %f",
+				&light.position[0], &light.position[1], &light.position[2], &light.position[3],
+				&light.diffuse[0], &light.diffuse[1], &light.diffuse[2],
+				&light.specular[0], &light.specular[1], &light.specular[2],
+				&light.attenuation[0], &light.attenuation[1], &light.attenuation[2]) == 13;
+			ok = ok && (int)lights.size() < MAX_SCENE_LIGHTS;
+			lights.push_back(light);
+		} else {
+			ok = false;
+		}
+	}
+	fclose(in);
+	if (!ok) {
+		fprintf(stderr, "%s:%d: cannot parse scene entry\n", textPath, lineNumber);
+		return EXIT_FAILURE;
+	}
+	// The arena line may come after the entries, so they are checked last
+	const char *what = NULL;
+	if (!sceneRecordsValid(header.half, header.maxHeight, props.data(), (unsigned int)props.size(),
+		goals.data(), (unsigned int)goals.size(), lights.data(), (unsigned int)lights.size(), what)) {
+		fprintf(stderr, "%s has a %s outside the arena or with invalid values\n", textPath, what);
+		return EXIT_FAILURE;
+	}
+
+	header.propCount = (unsigned int)props.size();
+	header.propOffset = sizeof(SceneFileHeader);
+	header.goalCount = (unsigned int)goals.size();
+	header.goalOffset = header.propOffset + header.propCount * sizeof(ScenePropRecord);
+	header.lightCount = (unsigned int)lights.size();
+	header.lightOffset = header.goalOffset + header.goalCount * sizeof(SceneGoalRecord);
+	FILE *out = fopen(binaryPath, "wb");
+	if (!out) {
+		fprintf(stderr, "Cannot write %s\n", binaryPath);
+		return EXIT_FAILURE;
+	}
+	bool written = fwrite(&header, sizeof(header), 1, out) == 1
+		&& fwrite(props.data(), sizeof(ScenePropRecord), props.size(), out) == props.size()
+		&& fwrite(goals.data(), sizeof(SceneGoalRecord), goals.size(), out) == goals.size()
+		&& fwrite(lights.data(), sizeof(SceneLightRecord), lights.size(), out) == lights.size();
+	written = fclose(out) == 0 && written;
+	if (!written) {
+		fprintf(stderr, "Cannot write %s\n", binaryPath);
+		return EXIT_FAILURE;
+	}
+	printf("Wrote %s: %u props, %u goals, %u lights\n", binaryPath, header.propCount, header.goalCount, header.lightCount);
+	return EXIT_SUCCESS;
+}
+
+const float GAME_TIME_LIMIT = 120.0f;
+
+int goalsRemaining(const GameSession &s) {
+	return s.goalsLeft;
+}
+
+// Grid coordinate of an arena position along x or z, clamped to the arena.
+// Clamped as a float so positions far outside (or NaN) never overflow the cast.
+int goalGridCoord(const GoalGrid &grid, float v) {
+	float coord = floorf((v + scene.half) / grid.cellSize);
+	if (!(coord > 0.0f)) {
+		return 0;
+	}
+	return coord >= (float)grid.columns ? grid.columns - 1 : (int)coord;
+}
+
+int goalGridCell(const GoalGrid &grid, float x, float z) {
+	return goalGridCoord(grid, z) * grid.columns + goalGridCoord(grid, x);
+}
+
+// Cells are as wide as a pickup sphere, so a query touches at most 2x2 cells.
+// Large arenas get wider cells instead of more than MAX_GOAL_GRID_COLUMNS.
+const int MAX_GOAL_GRID_COLUMNS = 1024;
+
+void buildGoalGrid(GameSession &s) {
+	GoalGrid &grid = s.goalGrid;
+	grid.cellSize = GOAL_RADIUS * 2.0f;
+	float columns = ceilf(scene.half * 2.0f / grid.cellSize);
+	if (!(columns <= (float)MAX_GOAL_GRID_COLUMNS)) {
+		columns = (float)MAX_GOAL_GRID_COLUMNS;
+		grid.cellSize = scene.half * 2.0f / columns;
+	}
+	grid.columns = std::max((int)columns, 1);
+	size_t cells = (size_t)grid.columns * (size_t)grid.columns;
+	grid.cellStart.assign(cells + 1, 0);
+	grid.cellLive.assign(cells, 0);
+	s.goalsLeft = 0;
+	const GoalStore &goals = s.goals;
+	for (size_t i = 0; i < goals.size(); ++i) {
+		if (!goals.collected[i]) {
+			++grid.cellLive[goalGridCell(grid, goals.x[i], goals.z[i])];
+			++s.goalsLeft;
+		}
+	}
+	for (size_t c = 0; c < cells; ++c) {
+		grid.cellStart[c + 1] = grid.cellStart[c] + grid.cellLive[c];
+	}
+	grid.slots.resize(s.goalsLeft);
+	std::vector<int> cursor(grid.cellStart.begin(), grid.cellStart.end() - 1);
+	for (size_t i = 0; i < goals.size(); ++i) {
+		if (!goals.collected[i]) {
+			grid.slots[cursor[goalGridCell(grid, goals.x[i], goals.z[i])]++] = (int)i;
+		}
+	}
+}
+
+void addGoal(GoalStore &goals, float x, float y, float z) {
+	goals.x.push_back(x);
+	goals.y.push_back(y);
+	goals.z.push_back(z);
+	goals.collected.push_back(0);
+}
+
+void initGoals(GameSession &s) {
+	s.goals = GoalStore();
+	for (unsigned int i = 0; i < scene.goalCount; ++i) {
+		addGoal(s.goals, scene.goals[i].x, scene.goals[i].y, scene.goals[i].z);
+	}
+	buildGoalGrid(s);
+}
+
+// Adds `count` goals at random reachable spots, for stress runs
+void scatterGoals(GameSession &s, int count, unsigned int seed) {
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> across(-scene.half + 0.1f, scene.half - 0.1f);
+	std::uniform_real_distribution<float> height(PLAYER_RADIUS, scene.maxHeight * 0.5f);
+	for (int i = 0; i < count; ++i) {
+		float x = across(rng);
+		float y = height(rng);
+		addGoal(s.goals, x, y, across(rng));
+	}
+	buildGoalGrid(s);
+}
+
+const float MODEL_SPEED[MODEL_COUNT] = { 1.2f, 0.9f, 1.6f, 2.0f, 1.4f };
+
+void addProp(PropStore &props, PropModel model, float x, float y, float z) {
+	props.x.push_back(x);
+	props.y.push_back(y);
+	props.z.push_back(z);
+	props.phase.push_back(0.0f);
+	props.speed.push_back(MODEL_SPEED[model]);
+	props.active.push_back(0);
+	props.model.push_back((unsigned char)model);
+}
+
+// Stable counting sort by model so every model is one contiguous range
+void sortPropsByModel(PropStore &props) {
+	int count[MODEL_COUNT] = { 0 };
+	for (size_t i = 0; i < props.size(); ++i) {
+		++count[props.model[i]];
+	}
+	props.modelStart[0] = 0;
+	for (int m = 0; m < MODEL_COUNT; ++m) {
+		props.modelStart[m + 1] = props.modelStart[m] + count[m];
+	}
+	int cursor[MODEL_COUNT];
+	std::copy(props.modelStart, props.modelStart + MODEL_COUNT, cursor);
+	PropStore sorted = props;
+	for (size_t i = 0; i < props.size(); ++i) {
+		int to = cursor[props.model[i]]++;
+		sorted.x[to] = props.x[i];
+		sorted.y[to] = props.y[i];
+		sorted.z[to] = props.z[i];
+		sorted.phase[to] = props.phase[i];
+		sorted.speed[to] = props.speed[i];
+		sorted.active[to] = props.active[i];
+		sorted.model[to] = props.model[i];
+	}
+	props = sorted;
+}
+
+void initProps(GameSession &s) {
+	s.props = PropStore();
+	for (unsigned int i = 0; i < scene.propCount; ++i) {
+		const ScenePropRecord &prop = scene.props[i];
+		addProp(s.props, (PropModel)prop.model, prop.x, prop.y, prop.z);
+	}
+	sortPropsByModel(s.props);
+}
+
+// Adds `count` props of random models on the arena floor, for stress runs
+void scatterProps(GameSession &s, int count, unsigned int seed) {
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> across(-scene.half + 0.1f, scene.half - 0.1f);
+	std::uniform_real_distribution<float> phase(0.0f, 10.0f);
+	for (int i = 0; i < count; ++i) {
+		PropModel model = (PropModel)(rng() % MODEL_COUNT);
+		float x = across(rng);
+		addProp(s.props, model, x, 0.0f, across(rng));
+		s.props.phase.back() = phase(rng);
+	}
+	sortPropsByModel(s.props);
+}
+
+void setPropsActive(PropStore &props, bool active) {
+	std::fill(props.active.begin(), props.active.end(), active ? 1 : 0);
+}
+
+void resetPlayer(Player &player) {
+	player.position = Vector3f(0.0f, PLAYER_RADIUS, 0.0f);
+	player.velocity = Vector3f();
+	player.yaw = 0.0f;
+	player.tilt = 0.0f;
+	player.airborne = false;
+}
+
+void resetSession(GameSession &s, float timeLimit) {
+	s.state = STATE_PLAYING;
+	s.remainingTime = timeLimit;
+	s.goalRotation = 0.0f;
+	s.wallColorPhase = 0.0f;
+	resetPlayer(s.player);
+	initProps(s);
+	initGoals(s);
+	s.moveForward = s.moveBackward = s.moveLeft = s.moveRight = false;
+	s.moveUp = s.moveDown = false;
+	s.timeWarningRaised = false;
+	s.hypeRaised = false;
+	s.events = 0;
+	s.pickups.clear();
+}
+
+void clearSessionEvents(GameSession &s) {
+	s.events = 0;
+	s.pickups.clear();
+}
+
+float clampf(float v, float minVal, float maxVal) {
+	if (v < minVal) {
+		return minVal;
+	}
+	if (v > maxVal) {
+		return maxVal;
+	}
+	return v;
+}
+
+void handlePlayerMovement(GameSession &s, float dt) {
+	Player &player = s.player;
+	Vector3f direction;
+	if (s.moveForward) {
+		direction.z -= 1.0f;
+	}
+	if (s.moveBackward) {
+		direction.z += 1.0f;
+	}
+	if (s.moveLeft) {
+		direction.x -= 1.0f;
+	}
+	if (s.moveRight) {
+		direction.x += 1.0f;
+	}
+	if (direction.length() > 0.0f) {
+		Vector3f dirUnit = direction.unit();
+		player.position += dirUnit * (PLAYER_SPEED * dt);
+		player.yaw = atan2f(dirUnit.x, -dirUnit.z) * 180.0f / 3.14159265f;
+	}
+	if (s.moveUp) {
+		player.position.y += PLAYER_ASCEND_SPEED * dt;
+	}
+	if (s.moveDown) {
+		player.position.y -= PLAYER_ASCEND_SPEED * dt;
+	}
+	float minY = PLAYER_RADIUS;
+	float wallThickness = 0.03f;
+	player.position.x = clampf(player.position.x, -scene.half + PLAYER_RADIUS + wallThickness, scene.half - PLAYER_RADIUS - wallThickness);
+	player.position.z = clampf(player.position.z, -scene.half + PLAYER_RADIUS + wallThickness, scene.half - PLAYER_RADIUS - wallThickness);
+	player.position.y = clampf(player.position.y, minY, scene.maxHeight);
+	bool onGround = fabsf(player.position.y - minY) < 0.002f;
+	player.airborne = !onGround;
+	player.tilt = player.airborne ? -20.0f : 0.0f;
+}
+
+void handleGoalCollection(GameSession &s) {
+	GoalGrid &grid = s.goalGrid;
+	const Vector3f &p = s.player.position;
+	int minColumn = goalGridCoord(grid, p.x - GOAL_RADIUS);
+	int maxColumn = goalGridCoord(grid, p.x + GOAL_RADIUS);
+	int minRow = goalGridCoord(grid, p.z - GOAL_RADIUS);
+	int maxRow = goalGridCoord(grid, p.z + GOAL_RADIUS);
+	const float radiusSquared = GOAL_RADIUS * GOAL_RADIUS;
+	for (int row = minRow; row <= maxRow; ++row) {
+		for (int column = minColumn; column <= maxColumn; ++column) {
+			int cell = row * grid.columns + column;
+			int first = grid.cellStart[cell];
+			for (int slot = first; slot < first + grid.cellLive[cell];) {
+				int goal = grid.slots[slot];
+				float dx = p.x - s.goals.x[goal];
+				float dy = p.y - s.goals.y[goal];
+				float dz = p.z - s.goals.z[goal];
+				if (dx * dx + dy * dy + dz * dz >= radiusSquared) {
+					++slot;
+					continue;
+				}
+				s.goals.collected[goal] = 1;
+				--s.goalsLeft;
+				s.pickups.push_back(goal);
+				s.events |= SESSION_EVENT_GOAL;
+				std::swap(grid.slots[slot], grid.slots[first + --grid.cellLive[cell]]);
+			}
+		}
+	}
+	if (s.goalsLeft == 0 && s.state == STATE_PLAYING) {
+		s.state = STATE_WIN;
+	}
+}
+
+// Branch-free so the compiler can vectorize it
+void updateAnimations(GameSession &s, float dt) {
+	PropStore &props = s.props;
+	float *phase = props.phase.data();
+	const float *speed = props.speed.data();
+	const unsigned char *active = props.active.data();
+	size_t count = props.size();
+	for (size_t i = 0; i < count; ++i) {
+		phase[i] += active[i] ? dt * speed[i] : 0.0f;
+	}
+}
+
+void stepSession(GameSession &s, float dt) {
+	if (s.state != STATE_PLAYING) {
+		return;
+	}
+	s.remainingTime -= dt;
+
+	if (!s.hypeRaised && s.remainingTime <= 78.0f) {
+		s.events |= SESSION_EVENT_HYPE;
+		s.hypeRaised = true;
+	}
+	if (s.remainingTime <= 10.0f && !s.timeWarningRaised) {
+		s.events |= SESSION_EVENT_TIME_WARNING;
+		s.timeWarningRaised = true;
+	}
+
+	if (s.remainingTime <= 0.0f) {
+		s.remainingTime = 0.0f;
+		s.state = goalsRemaining(s) == 0 ? STATE_WIN : STATE_LOSE;
+	}
+	s.goalRotation += dt * 50.0f;
+	s.wallColorPhase += dt * 0.7f;
+	handlePlayerMovement(s, dt);
+	updateAnimations(s, dt);
+	handleGoalCollection(s);
+}
+
+// Frontend: the windowed/benchmark game drives the global session and turns
+// its events into sound.
+void resetGame() {
+	resetSession(game, GAME_TIME_LIMIT);
+	startBackgroundMusic();
+	syncRenderState();
+	lastTick = elapsedMillis();
+}
+
+void handleSessionEvents(const GameSession &s) {
+	static bool ytOpened = false;
+	unsigned int events = s.events;
+	for (size_t i = 0; i < s.pickups.size(); ++i) {
+		playEffect(SOUND_ASSET_GOAL);
+	}
+	// Open YouTube link at the Crab Rave drop, once per run
+	if ((events & SESSION_EVENT_HYPE) && !ytOpened) {
+#if defined(__APPLE__)
+		std::string cmd = "open '" + std::string(YOUTUBE_LINK) + "'";
+		system(cmd.c_str());
+#elif defined(_WIN32)
+		std::string cmd = "start " + std::string(YOUTUBE_LINK);
+		system(cmd.c_str());
+#endif
+		ytOpened = true;
+	}
+	// At 10 seconds remaining, stop music and play the buzzer
+	if (events & SESSION_EVENT_TIME_WARNING) {
+		stopBackgroundMusic();  // Stop Crab Rave
+		playEffect(SOUND_ASSET_BUZZER);
+	}
+}
+
+void updateGame(float dt) {
+	TraceScope trace("updateGame");
+	ProfileScope scope(ZONE_UPDATE);
+	clearSessionEvents(game);
+	stepSession(game, dt);
+	handleSessionEvents(game);
+}
+
+// View-frustum culling. setupCamera builds the same projection and view it
+// loads into GL on the CPU and extracts the six clip planes from their product
+// (Gribb/Hartmann), normalized and pointing inward. Draw code tests bounding
+// volumes in world space against them and skips whatever lies fully outside.
+const float CAMERA_FOV = 60.0f;
+const float CAMERA_NEAR = 0.01f;
+const float CAMERA_FAR = 100.0f;
+
+struct Frustum {
+	float planes[6][4]; // a, b, c, d with ax + by + cz + d >= 0 inside
+};
+
+Frustum viewFrustum;
+float viewMatrix[16];       // camera transform loaded by setupCamera
+float projectionMatrix[16]; // rebuilt with the GL projection
+float cameraAspect = 640.0f / 480.0f;
+float viewportHeight = 480.0f;
+bool cullingEnabled = true;
+
+// Four-wide float math: SSE2 on x86, NEON on ARM, plain arrays elsewhere.
+// The batch kernels built on it evaluate every expression in the same order
+// as the scalar code they replace, so culling, light positions and the
+// simulation's goal search come out bit for bit as before.
+#if defined(__SSE2__) || defined(_M_X64)
+typedef __m128 Float4;
+
+Float4 load4(const float *p) {
+	return _mm_loadu_ps(p);
+}
+
+void store4(float *p, Float4 v) {
+	_mm_storeu_ps(p, v);
+}
+
+Float4 splat4(float v) {
+	return _mm_set1_ps(v);
+}
+
+Float4 add4(Float4 a, Float4 b) {
+	return _mm_add_ps(a, b);
+}
+
+Float4 sub4(Float4 a, Float4 b) {
+	return _mm_sub_ps(a, b);
+}
+
+Float4 mul4(Float4 a, Float4 b) {
+	return _mm_mul_ps(a, b);
+}
+
+Float4 div4(Float4 a, Float4 b) {
+	return _mm_div_ps(a, b);
+}
+
+Float4 sqrt4(Float4 a) {
+	return _mm_sqrt_ps(a);
+}
+
+// Bit i set when lane i of a is less than lane i of b
+int lessMask4(Float4 a, Float4 b) {
+	return _mm_movemask_ps(_mm_cmplt_ps(a, b));
+}
+#elif defined(__ARM_NEON)
+typedef float32x4_t Float4;
+
+Float4 load4(const float *p) {
+	return vld1q_f32(p);
+}
+
+void store4(float *p, Float4 v) {
+	vst1q_f32(p, v);
+}
+
+Float4 splat4(float v) {
+	return vdupq_n_f32(v);
+}
+
+Float4 add4(Float4 a, Float4 b) {
+	return vaddq_f32(a, b);
+}
+
+Float4 sub4(Float4 a, Float4 b) {
+	return vsubq_f32(a, b);
+}
+
+Float4 mul4(Float4 a, Float4 b) {
+	return vmulq_f32(a, b);
+}
+
+// 32-bit NEON has no IEEE divide or square root, so it goes lane by lane
+#if defined(__aarch64__)
+Float4 div4(Float4 a, Float4 b) {
+	return vdivq_f32(a, b);
+}
+
+Float4 sqrt4(Float4 a) {
+	return vsqrtq_f32(a);
+}
+#else
+Float4 div4(Float4 a, Float4 b) {
+	float x[4], y[4];
+	vst1q_f32(x, a);
+	vst1q_f32(y, b);
+	for (int i = 0; i < 4; ++i) {
+		x[i] /= y[i];
+	}
+	return vld1q_f32(x);
+}
+
+Float4 sqrt4(Float4 a) {
+	float x[4];
+	vst1q_f32(x, a);
+	for (int i = 0; i < 4; ++i) {
+		x[i] = sqrtf(x[i]);
+	}
+	return vld1q_f32(x);
+}
+#endif
+
+int lessMask4(Float4 a, Float4 b) {
+	uint32x4_t less = vcltq_f32(a, b);
+	return (vgetq_lane_u32(less, 0) & 1) | (vgetq_lane_u32(less, 1) & 2) | (vgetq_lane_u32(less, 2) & 4) | (vgetq_lane_u32(less, 3) & 8);
+}
+#else
+struct Float4 {
+	float v[4];
+};
+
+Float4 load4(const float *p) {
+	Float4 r;
+	memcpy(r.v, p, sizeof(r.v));
+	return r;
+}
+
+void store4(float *p, Float4 v) {
+	memcpy(p, v.v, sizeof(v.v));
+}
+
+Float4 splat4(float v) {
+	Float4 r = {{ v, v, v, v }};
+	return r;
+}
+
+Float4 add4(Float4 a, Float4 b) {
+	for (int i = 0; i < 4; ++i) {
+		a.v[i] += b.v[i];
+	}
+	return a;
+}
+
+Float4 sub4(Float4 a, Float4 b) {
+	for (int i = 0; i < 4; ++i) {
+		a.v[i] -= b.v[i];
+	}
+	return a;
+}
+
+Float4 mul4(Float4 a, Float4 b) {
+	for (int i = 0; i < 4; ++i) {
+		a.v[i] *= b.v[i];
+	}
+	return a;
+}
+
+Float4 div4(Float4 a, Float4 b) {
+	for (int i = 0; i < 4; ++i) {
+		a.v[i] /= b.v[i];
+	}
+	return a;
+}
+
+Float4 sqrt4(Float4 a) {
+	for (int i = 0; i < 4; ++i) {
+		a.v[i] = sqrtf(a.v[i]);
+	}
+	return a;
+}
+
+int lessMask4(Float4 a, Float4 b) {
+	int mask = 0;
+	for (int i = 0; i < 4; ++i) {
+		mask |= (a.v[i] < b.v[i]) << i;
+	}
+	return mask;
+}
+#endif
+
+// out = m * v for a column-major m; out must not overlap m
+void transformVector(const float m[16], const float v[4], float out[4]) {
+	Float4 r = mul4(load4(m), splat4(v[0]));
+	r = add4(r, mul4(load4(m + 4), splat4(v[1])));
+	r = add4(r, mul4(load4(m + 8), splat4(v[2])));
+	r = add4(r, mul4(load4(m + 12), splat4(v[3])));
+	store4(out, r);
+}
+
+// 4x4 matrices are column-major float[16], as OpenGL stores them
+void multiplyMatrix(const float a[16], const float b[16], float out[16]) {
+	for (int c = 0; c < 4; ++c) {
+		transformVector(a, b + c * 4, out + c * 4);
+	}
+}
+
+// Index of the point nearest to (px, py, pz) among those whose skip byte is
+// zero, or -1 if there are none. Ties go to the lowest index, as in a linear
+// scan. Blocks of four with nothing closer than the best so far cost one
+// compare. If no distance is finite (every point at infinity or NaN) the
+// first candidate wins, so there is always a target while any remain.
+int nearestPoint(const float *x, const float *y, const float *z, const unsigned char *skip, int count, float px, float py, float pz) {
+	int nearest = -1;
+	float best = HUGE_VALF;
+	Float4 ox = splat4(px), oy = splat4(py), oz = splat4(pz);
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		Float4 dx = sub4(load4(x + i), ox);
+		Float4 dy = sub4(load4(y + i), oy);
+		Float4 dz = sub4(load4(z + i), oz);
+		Float4 distance = add4(add4(mul4(dx, dx), mul4(dy, dy)), mul4(dz, dz));
+		if (!lessMask4(distance, splat4(best))) {
+			continue;
+		}
+		float lanes[4];
+		store4(lanes, distance);
+		for (int l = 0; l < 4; ++l) {
+			if (!skip[i + l] && lanes[l] < best) {
+				nearest = i + l;
+				best = lanes[l];
+			}
+		}
+	}
+	for (; i < count; ++i) {
+		float dx = x[i] - px, dy = y[i] - py, dz = z[i] - pz;
+		float distance = dx * dx + dy * dy + dz * dz;
+		if (!skip[i] && distance < best) {
+			nearest = i;
+			best = distance;
+		}
+	}
+	for (i = 0; nearest < 0 && i < count; ++i) {
+		if (!skip[i]) {
+			nearest = i;
+		}
+	}
+	return nearest;
+}
+
+// Scales each (x, y, z) to unit length in place and stores the old length in
+// `length`. Zero-length vectors divide by zero like the scalar code would.
+void normalizeVectors(float *x, float *y, float *z, float *length, int count) {
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		Float4 vx = load4(x + i), vy = load4(y + i), vz = load4(z + i);
+		Float4 l = sqrt4(add4(add4(mul4(vx, vx), mul4(vy, vy)), mul4(vz, vz)));
+		store4(x + i, div4(vx, l));
+		store4(y + i, div4(vy, l));
+		store4(z + i, div4(vz, l));
+		store4(length + i, l);
+	}
+	for (; i < count; ++i) {
+		length[i] = sqrtf(x[i] * x[i] + y[i] * y[i] + z[i] * z[i]);
+		x[i] /= length[i];
+		y[i] /= length[i];
+		z[i] /= length[i];
+	}
+}
+
+void perspectiveMatrix(float fovy, float aspect, float zNear, float zFar, float out[16]) {
+	float f = 1.0f / tanf(DEG2RAD(fovy) * 0.5f);
+	for (int i = 0; i < 16; ++i) {
+		out[i] = 0.0f;
+	}
+	out[0] = f / aspect;
+	out[5] = f;
+	out[10] = (zFar + zNear) / (zNear - zFar);
+	out[11] = -1.0f;
+	out[14] = 2.0f * zFar * zNear / (zNear - zFar);
+}
+
+// Same matrix gluLookAt builds
+void lookAtMatrix(const Camera &c, float out[16]) {
+	Vector3f f = (c.center - c.eye).unit();
+	Vector3f s = f.cross(c.up).unit();
+	Vector3f u = s.cross(f);
+	out[0] = s.x; out[4] = s.y; out[8] = s.z;
+	out[1] = u.x; out[5] = u.y; out[9] = u.z;
+	out[2] = -f.x; out[6] = -f.y; out[10] = -f.z;
+	out[3] = out[7] = out[11] = 0.0f;
+	out[12] = -(s.x * c.eye.x + s.y * c.eye.y + s.z * c.eye.z);
+	out[13] = -(u.x * c.eye.x + u.y * c.eye.y + u.z * c.eye.z);
+	out[14] = f.x * c.eye.x + f.y * c.eye.y + f.z * c.eye.z;
+	out[15] = 1.0f;
+}
+
+void extractFrustum(const float m[16], Frustum &frustum) {
+	// One row per plane coefficient, so the normals go through normalizeVectors
+	float coefficients[4][6];
+	for (int i = 0; i < 6; ++i) {
+		int row = i / 2;
+		float sign = (i % 2 == 0) ? 1.0f : -1.0f; // left/bottom/near, then right/top/far
+		for (int j = 0; j < 4; ++j) {
+			coefficients[j][i] = m[j * 4 + 3] + sign * m[j * 4 + row];
+		}
+	}
+	float length[6];
+	normalizeVectors(coefficients[0], coefficients[1], coefficients[2], length, 6);
+	for (int i = 0; i < 6; ++i) {
+		for (int j = 0; j < 3; ++j) {
+			frustum.planes[i][j] = coefficients[j][i];
+		}
+		frustum.planes[i][3] = coefficients[3][i] / length[i];
+	}
+}
+
+bool sphereInFrustum(float x, float y, float z, float radius) {
+	for (int i = 0; i < 6; ++i) {
+		const float *plane = viewFrustum.planes[i];
+		if (plane[0] * x + plane[1] * y + plane[2] * z + plane[3] < -radius) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool sphereVisible(float x, float y, float z, float radius) {
+	if (!cullingEnabled || sphereInFrustum(x, y, z, radius)) {
+		return true;
+	}
+	++frameCounters.culled;
+	return false;
+}
+
+// Batch sphereInFrustum over structure-of-arrays positions: sphere i is
+// centered at (x[i], y[i] + yOffset, z[i]) and visible[i] is set to 1 when it
+// is at least partly inside (always, with culling off)
+void spheresInFrustum(const float *x, const float *y, const float *z, int count, float yOffset, float radius, unsigned char *visible) {
+	if (!cullingEnabled) {
+		memset(visible, 1, count);
+		return;
+	}
+	Float4 offset = splat4(yOffset);
+	Float4 limit = splat4(-radius);
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		Float4 px = load4(x + i);
+		Float4 py = add4(load4(y + i), offset);
+		Float4 pz = load4(z + i);
+		int outside = 0;
+		for (int p = 0; p < 6; ++p) {
+			const float *plane = viewFrustum.planes[p];
+			Float4 d = add4(add4(add4(mul4(splat4(plane[0]), px), mul4(splat4(plane[1]), py)), mul4(splat4(plane[2]), pz)), splat4(plane[3]));
+			outside |= lessMask4(d, limit);
+		}
+		for (int l = 0; l < 4; ++l) {
+			visible[i + l] = !((outside >> l) & 1);
+		}
+	}
+	for (; i < count; ++i) {
+		visible[i] = sphereInFrustum(x[i], y[i] + yOffset, z[i], radius);
+	}
+}
+
+// Axis-aligned box test: only the corner furthest along each plane normal
+// needs checking
+bool boxVisible(const float minCorner[3], const float maxCorner[3]) {
+	if (!cullingEnabled) {
+		return true;
+	}
+	for (int i = 0; i < 6; ++i) {
+		const float *plane = viewFrustum.planes[i];
+		float x = plane[0] >= 0.0f ? maxCorner[0] : minCorner[0];
+		float y = plane[1] >= 0.0f ? maxCorner[1] : minCorner[1];
+		float z = plane[2] >= 0.0f ? maxCorner[2] : minCorner[2];
+		if (plane[0] * x + plane[1] * y + plane[2] * z + plane[3] < 0.0f) {
+			++frameCounters.culled;
+			return false;
+		}
+	}
+	return true;
+}
+
+// The projection only changes with the window size; the view every frame
+void setupCamera() {
+	if (glState.projection) {
+		countDroppedState(4);
+	} else {
+		glMatrixMode(GL_PROJECTION);
+		glLoadIdentity();
+		gluPerspective(CAMERA_FOV, cameraAspect, CAMERA_NEAR, CAMERA_FAR);
+		glMatrixMode(GL_MODELVIEW);
+		perspectiveMatrix(CAMERA_FOV, cameraAspect, CAMERA_NEAR, CAMERA_FAR, projectionMatrix);
+		countStateChanges(1);
+		glState.projection = true;
+	}
+
+	glLoadIdentity();
+	camera.look();
+
+	float clip[16];
+	lookAtMatrix(camera, viewMatrix);
+	multiplyMatrix(projectionMatrix, viewMatrix, clip);
+	extractFrustum(clip, viewFrustum);
+}
+
+// Shared by the fixed-function setup below and the shader renderer's frame data
+const GLfloat MATERIAL_SPECULAR[4] = { 0.9f, 0.95f, 1.0f, 1.0f };
+const GLfloat MATERIAL_SHININESS = 80.0f;
+const GLfloat FOG_COLOR[4] = { 0.05f, 0.15f, 0.22f, 1.0f };
+const GLfloat FOG_START = 1.5f;
+const GLfloat FOG_END = 4.0f;
+
+// Materials, light colors and fog never change, so they are uploaded once per
+// context. Light positions are stored by GL in eye space, so they only need
+// re-sending when the camera moved.
+void setupLights() {
+	TraceScope trace("setupLights");
+	const int staticCalls = 4 + 5 * scene.lightCount + 5;
+	if (glState.staticLighting) {
+		countDroppedState(staticCalls);
+	} else {
+		// Enhanced material properties for underwater metallic surfaces
+		GLfloat ambient[] = { 0.15f, 0.22f, 0.3f, 1.0f };
+		GLfloat diffuse[] = { 0.5f, 0.65f, 0.75f, 1.0f };
+		glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, ambient);
+		glMaterialfv(GL_FRONT, GL_DIFFUSE, diffuse);
+		glMaterialfv(GL_FRONT, GL_SPECULAR, MATERIAL_SPECULAR);
+		glMaterialf(GL_FRONT, GL_SHININESS, MATERIAL_SHININESS);
+
+		// Scene lights (the default scene has a cool overhead light and a warm accent)
+		for (unsigned int i = 0; i < scene.lightCount; ++i) {
+			const SceneLightRecord &light = scene.lights[i];
+			GLenum id = GL_LIGHT0 + i;
+			glLightfv(id, GL_DIFFUSE, light.diffuse);
+			glLightfv(id, GL_SPECULAR, light.specular);
+			glLightf(id, GL_CONSTANT_ATTENUATION, light.attenuation[0]);
+			glLightf(id, GL_LINEAR_ATTENUATION, light.attenuation[1]);
+			glLightf(id, GL_QUADRATIC_ATTENUATION, light.attenuation[2]);
+		}
+
+		// Underwater fog effect
+		glFogfv(GL_FOG_COLOR, FOG_COLOR);
+		glFogi(GL_FOG_MODE, GL_LINEAR);
+		glFogf(GL_FOG_START, FOG_START);
+		glFogf(GL_FOG_END, FOG_END);
+		glFogf(GL_FOG_DENSITY, 0.3f);
+		countStateChanges(staticCalls);
+		glState.staticLighting = true;
+	}
+
+	for (unsigned int i = 0; i < scene.lightCount; ++i) {
+		const GLfloat *position = scene.lights[i].position;
+		GLfloat eye[4];
+		transformVector(viewMatrix, position, eye);
+		if (glState.lightPositionKnown[i] && memcmp(eye, glState.lightPositions[i], sizeof(eye)) == 0) {
+			countDroppedState(1);
+		} else {
+			glLightfv(GL_LIGHT0 + i, GL_POSITION, position); // the modelview holds the view here
+			memcpy(glState.lightPositions[i], eye, sizeof(eye));
+			glState.lightPositionKnown[i] = true;
+			countStateChanges(1);
+		}
+		enableCap(GL_LIGHT0 + i);
+	}
+	enableCap(GL_FOG);
+}
+
+void Reshape(int width, int height) {
+	height = height > 0 ? height : 1;
+	glViewport(0, 0, width, height);
+	cameraAspect = (float)width / height;
+	viewportHeight = (float)height;
+	glState.projection = false;
+}
+
+// Level of detail. Each object picks a level from the projected radius of its
+// bounding sphere in pixels; sphere, torus and cone tessellation is halved per
+// level, fine detail (bolts, vents, rivets) is dropped from LOD_COARSE on, and
+// props below the last threshold collapse to a single-box impostor.
+enum LodLevel {
+	LOD_FULL,
+	LOD_REDUCED,
+	LOD_COARSE,
+	LOD_IMPOSTOR
+};
+
+const float LOD_MIN_PIXELS[LOD_IMPOSTOR] = { 48.0f, 20.0f, 6.0f }; // smallest projected radius per level
+
+thread_local LodLevel lodLevel = LOD_FULL; // level of the object being drawn
+bool lodEnabled = true;
+
+// Projected radius in pixels of a sphere `distance` away from the eye
+float projectedPixels(float radius, float distance) {
+	if (distance <= radius) {
+		return viewportHeight;
+	}
+	return radius * viewportHeight * 0.5f / (distance * tanf(DEG2RAD(CAMERA_FOV) * 0.5f));
+}
+
+LodLevel selectLod(float x, float y, float z, float radius) {
+	lodLevel = LOD_FULL;
+	if (!lodEnabled) {
+		return lodLevel;
+	}
+	float pixels = projectedPixels(radius, (Vector3f(x, y, z) - camera.eye).length());
+	while (lodLevel < LOD_IMPOSTOR && pixels < LOD_MIN_PIXELS[lodLevel]) {
+		lodLevel = (LodLevel)(lodLevel + 1);
+	}
+	return lodLevel;
+}
+
+// Slices, stacks, sides or rings for the current level, never below `minimum`
+int lodDivisions(int count, int minimum) {
+	int level = lodLevel < LOD_COARSE ? lodLevel : LOD_COARSE;
+	return std::max(count >> level, std::min(count, minimum));
+}
+
+// Small parts that vanish at a distance
+bool lodDetail() {
+	return lodLevel < LOD_COARSE;
+}
+
+// Primitive mesh cache: every (shape, slices, stacks) variant is tessellated
+// once into a vertex/index buffer pair and then drawn with a single call.
+enum PrimitiveShape {
+	SHAPE_CUBE,
+	SHAPE_SPHERE,
+	SHAPE_TORUS,
+	SHAPE_CONE
+};
+
+struct PrimitiveKey {
+	PrimitiveShape shape;
+	int slices;
+	int stacks;
+	int ratio; // torus tube/ring radius ratio in thousandths, 0 otherwise
+
+	bool operator<(const PrimitiveKey &k) const {
+		if (shape != k.shape) {
+			return shape < k.shape;
+		}
+		if (slices != k.slices) {
+			return slices < k.slices;
+		}
+		if (stacks != k.stacks) {
+			return stacks < k.stacks;
+		}
+		return ratio < k.ratio;
+	}
+};
+
+// A tessellation generated at compile time (see EMBEDDED_MESHES)
+struct EmbeddedMesh {
+	PrimitiveKey key;
+	const GLfloat *vertices; // interleaved position, normal
+	int vertexCount;
+	const GLuint *indices;
+	int indexCount;
+};
+
+struct Mesh {
+	GLuint vertexBuffer;
+	GLuint indexBuffer;
+	GLsizei indexCount;
+	size_t colorOffset; // byte offset of the per-vertex colors, 0 if uncolored
+	GLint baseVertex;   // where the mesh starts in meshPool
+	GLuint firstIndex;
+};
+
+// CPU copy of every uploaded mesh, back to back, for the shader renderer: one
+// vertex and index buffer lets a single multi-draw reach any mesh. Vertices
+// are position, normal and rgba color; uncolored meshes store alpha 0 and take
+// the draw's color instead.
+const int POOL_VERTEX_FLOATS = 10;
+
+struct MeshPool {
+	std::vector<GLfloat> vertices;
+	std::vector<GLuint> indices; // relative to the mesh's baseVertex
+};
+
+MeshPool meshPool;
+
+struct MeshBuilder {
+	std::vector<GLfloat> vertices; // interleaved position, normal
+	std::vector<GLfloat> colors;   // optional rgb per vertex, stored after the vertices
+	std::vector<GLuint> indices;
+	bool colored;
+	float color[3];
+
+	MeshBuilder() : colored(false) {
+		color[0] = color[1] = color[2] = 1.0f;
+	}
+
+	// Every vertex added after this carries the given color
+	void setColor(float r, float g, float b) {
+		colored = true;
+		color[0] = r;
+		color[1] = g;
+		color[2] = b;
+	}
+
+	GLuint vertexCount() const {
+		return (GLuint)(vertices.size() / 6);
+	}
+
+	GLuint addVertex(float px, float py, float pz, float nx, float ny, float nz) {
+		GLuint index = vertexCount();
+		vertices.push_back(px);
+		vertices.push_back(py);
+		vertices.push_back(pz);
+		vertices.push_back(nx);
+		vertices.push_back(ny);
+		vertices.push_back(nz);
+		if (colored) {
+			colors.resize(index * 3, 1.0f);
+			colors.insert(colors.end(), color, color + 3);
+		}
+		return index;
+	}
+
+	void addTriangle(GLuint a, GLuint b, GLuint c) {
+		indices.push_back(a);
+		indices.push_back(b);
+		indices.push_back(c);
+	}
+
+	void addQuad(GLuint a, GLuint b, GLuint c, GLuint d) {
+		addTriangle(a, b, c);
+		addTriangle(a, c, d);
+	}
+
+	// Copies an embedded tessellation in, in the current color if one is set
+	void append(const EmbeddedMesh &mesh) {
+		GLuint first = vertexCount();
+		for (int v = 0; v < mesh.vertexCount; ++v) {
+			const GLfloat *p = &mesh.vertices[v * 6];
+			addVertex(p[0], p[1], p[2], p[3], p[4], p[5]);
+		}
+		for (int i = 0; i < mesh.indexCount; ++i) {
+			indices.push_back(first + mesh.indices[i]);
+		}
+	}
+
+	Mesh upload() const {
+		Mesh mesh;
+		size_t vertexBytes = vertices.size() * sizeof(GLfloat);
+		size_t colorBytes = colored ? colors.size() * sizeof(GLfloat) : 0;
+		glGenBuffers(1, &mesh.vertexBuffer);
+		bindArrayBuffer(mesh.vertexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, vertexBytes + colorBytes, NULL, GL_STATIC_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, vertexBytes, vertices.data());
+		if (colored) {
+			glBufferSubData(GL_ARRAY_BUFFER, vertexBytes, colorBytes, colors.data());
+		}
+		mesh.colorOffset = colored ? vertexBytes : 0;
+		glGenBuffers(1, &mesh.indexBuffer);
+		bindElementBuffer(mesh.indexBuffer);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+		mesh.indexCount = (GLsizei)indices.size();
+
+		mesh.baseVertex = (GLint)(meshPool.vertices.size() / POOL_VERTEX_FLOATS);
+		mesh.firstIndex = (GLuint)meshPool.indices.size();
+		for (size_t v = 0; v * 6 < vertices.size(); ++v) {
+			meshPool.vertices.insert(meshPool.vertices.end(), &vertices[v * 6], &vertices[v * 6] + 6);
+			for (int c = 0; c < 3; ++c) {
+				meshPool.vertices.push_back(colored ? colors[v * 3 + c] : 1.0f);
+			}
+			meshPool.vertices.push_back(colored ? 1.0f : 0.0f);
+		}
+		meshPool.indices.insert(meshPool.indices.end(), indices.begin(), indices.end());
+		return mesh;
+	}
+};
+
+std::map<PrimitiveKey, Mesh> primitiveMeshes;
+bool primitiveMeshesFrozen = false; // set once initRendering has built them all
+const Mesh *boundMesh = NULL;
+
+constexpr float PI = 3.14159265f;
+
+// Fixed-size mesh that the tessellation templates below can fill in a
+// constant expression; MeshBuilder offers the same interface at run time
+template <int VertexCapacity, int IndexCapacity>
+struct MeshTable {
+	GLfloat vertices[VertexCapacity * 6];
+	GLuint indices[IndexCapacity];
+	int vertexSize;
+	int indexSize;
+
+	constexpr MeshTable() : vertices(), indices(), vertexSize(0), indexSize(0) {
+	}
+
+	constexpr GLuint vertexCount() const {
+		return (GLuint)vertexSize;
+	}
+
+	constexpr GLuint addVertex(float px, float py, float pz, float nx, float ny, float nz) {
+		GLfloat *v = &vertices[vertexSize * 6];
+		v[0] = px;
+		v[1] = py;
+		v[2] = pz;
+		v[3] = nx;
+		v[4] = ny;
+		v[5] = nz;
+		return (GLuint)vertexSize++;
+	}
+
+	constexpr void addTriangle(GLuint a, GLuint b, GLuint c) {
+		indices[indexSize++] = a;
+		indices[indexSize++] = b;
+		indices[indexSize++] = c;
+	}
+
+	constexpr void addQuad(GLuint a, GLuint b, GLuint c, GLuint d) {
+		addTriangle(a, b, c);
+		addTriangle(a, c, d);
+	}
+};
+
+// sinf, cosf and sqrtf stand-ins that also work in constant expressions:
+// evaluated in double and rounded to float once
+constexpr double HALF_PI_D = 1.5707963267948966;
+
+// Taylor series after folding x into [-pi/2, pi/2]
+constexpr double seriesSin(double x) {
+	while (x > 2.0 * HALF_PI_D) {
+		x -= 4.0 * HALF_PI_D;
+	}
+	while (x < -2.0 * HALF_PI_D) {
+		x += 4.0 * HALF_PI_D;
+	}
+	if (x > HALF_PI_D) {
+		x = 2.0 * HALF_PI_D - x;
+	} else if (x < -HALF_PI_D) {
+		x = -2.0 * HALF_PI_D - x;
+	}
+	double term = x;
+	double sum = x;
+	for (int n = 1; n <= 12; ++n) {
+		term *= -x * x / ((2.0 * n) * (2.0 * n + 1.0));
+		sum += term;
+	}
+	return sum;
+}
+
+constexpr float tableSin(float angle) {
+	return (float)seriesSin(angle);
+}
+
+constexpr float tableCos(float angle) {
+	return (float)seriesSin(HALF_PI_D - angle);
+}
+
+constexpr float tableSqrt(float value) {
+	double x = value > 1.0f ? value : 1.0;
+	for (int i = 0; i < 64; ++i) {
+		x = 0.5 * (x + value / x);
+	}
+	return (float)x;
+}
+
+// Tessellation templates. Each one fills a MeshTable at compile time for the
+// embedded meshes, or a MeshBuilder at run time for anything else.
+
+// Unit cube centered on the origin, matching glutSolidCube(1.0)
+template <class Builder>
+constexpr void buildCube(Builder &b) {
+	const float n[6][3] = {{1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+	for (int f = 0; f < 6; ++f) {
+		// Two axes spanning the face, ordered so the winding faces outward
+		float u[3] = { n[f][1], n[f][2], n[f][0] };
+		float v[3] = { n[f][1] * u[2] - n[f][2] * u[1], n[f][2] * u[0] - n[f][0] * u[2], n[f][0] * u[1] - n[f][1] * u[0] };
+		GLuint corner[4] = {};
+		const float s[4][2] = {{-1, -1}, {1, -1}, {1, 1}, {-1, 1}};
+		for (int c = 0; c < 4; ++c) {
+			corner[c] = b.addVertex(
+				0.5f * (n[f][0] + s[c][0] * u[0] + s[c][1] * v[0]),
+				0.5f * (n[f][1] + s[c][0] * u[1] + s[c][1] * v[1]),
+				0.5f * (n[f][2] + s[c][0] * u[2] + s[c][1] * v[2]),
+				n[f][0], n[f][1], n[f][2]);
+		}
+		b.addQuad(corner[0], corner[1], corner[2], corner[3]);
+	}
+}
+
+// Unit sphere with its poles on the z axis, matching glutSolidSphere
+template <class Builder>
+constexpr void buildSphere(Builder &b, int slices, int stacks) {
+	GLuint first = b.vertexCount();
+	for (int i = 0; i <= stacks; ++i) {
+		float theta = PI * i / stacks;
+		for (int j = 0; j <= slices; ++j) {
+			float phi = 2.0f * PI * j / slices;
+			float x = tableSin(theta) * tableCos(phi);
+			float y = tableSin(theta) * tableSin(phi);
+			float z = tableCos(theta);
+			b.addVertex(x, y, z, x, y, z);
+		}
+	}
+	for (int i = 0; i < stacks; ++i) {
+		for (int j = 0; j < slices; ++j) {
+			GLuint a = first + i * (slices + 1) + j;
+			GLuint c = a + slices + 1;
+			b.addQuad(a, c, c + 1, a + 1);
+		}
+	}
+}
+
+// Torus in the xy plane with a ring radius of 1, matching glutSolidTorus
+template <class Builder>
+constexpr void buildTorus(Builder &b, int sides, int rings, float tube) {
+	GLuint first = b.vertexCount();
+	for (int i = 0; i <= rings; ++i) {
+		float theta = 2.0f * PI * i / rings;
+		for (int j = 0; j <= sides; ++j) {
+			float phi = 2.0f * PI * j / sides;
+			float nx = tableCos(phi) * tableCos(theta);
+			float ny = tableCos(phi) * tableSin(theta);
+			float nz = tableSin(phi);
+			b.addVertex(tableCos(theta) + tube * nx, tableSin(theta) + tube * ny, tube * nz, nx, ny, nz);
+		}
+	}
+	for (int i = 0; i < rings; ++i) {
+		for (int j = 0; j < sides; ++j) {
+			GLuint a = first + i * (sides + 1) + j;
+			GLuint c = a + sides + 1;
+			b.addQuad(a, c, c + 1, a + 1);
+		}
+	}
+}
+
+// Cone with a unit base on z = 0 and its apex at z = 1, matching glutSolidCone
+template <class Builder>
+constexpr void buildCone(Builder &b, int slices, int stacks) {
+	float slant = 1.0f / tableSqrt(2.0f);
+	GLuint first = b.vertexCount();
+	for (int i = 0; i <= stacks; ++i) {
+		float z = (float)i / stacks;
+		float r = 1.0f - z;
+		for (int j = 0; j <= slices; ++j) {
+			float phi = 2.0f * PI * j / slices;
+			b.addVertex(r * tableCos(phi), r * tableSin(phi), z, slant * tableCos(phi), slant * tableSin(phi), slant);
+		}
+	}
+	for (int i = 0; i < stacks; ++i) {
+		for (int j = 0; j < slices; ++j) {
+			GLuint a = first + i * (slices + 1) + j;
+			GLuint c = a + slices + 1;
+			b.addQuad(a, a + 1, c + 1, c);
+		}
+	}
+	// Base cap
+	GLuint center = b.addVertex(0.0f, 0.0f, 0.0f, 0.0f, 0.0f, -1.0f);
+	GLuint rim = b.vertexCount();
+	for (int j = 0; j <= slices; ++j) {
+		float phi = 2.0f * PI * j / slices;
+		b.addVertex(tableCos(phi), tableSin(phi), 0.0f, 0.0f, 0.0f, -1.0f);
+	}
+	for (int j = 0; j < slices; ++j) {
+		b.addTriangle(center, rim + j + 1, rim + j);
+	}
+}
+
+// Open tube along +z from 0 to height, matching gluCylinder
+template <class Builder>
+constexpr void buildCylinder(Builder &b, float base, float top, float height, int slices, int stacks) {
+	float slope = (base - top) / height;
+	float normalScale = 1.0f / tableSqrt(1.0f + slope * slope);
+	GLuint first = b.vertexCount();
+	for (int i = 0; i <= stacks; ++i) {
+		float t = (float)i / stacks;
+		float r = base + (top - base) * t;
+		for (int j = 0; j <= slices; ++j) {
+			float phi = 2.0f * PI * j / slices;
+			b.addVertex(r * tableSin(phi), r * tableCos(phi), height * t, normalScale * tableSin(phi), normalScale * tableCos(phi), normalScale * slope);
+		}
+	}
+	for (int i = 0; i < stacks; ++i) {
+		for (int j = 0; j < slices; ++j) {
+			GLuint a = first + i * (slices + 1) + j;
+			GLuint c = a + slices + 1;
+			b.addQuad(a, c, c + 1, a + 1);
+		}
+	}
+}
+
+// Places the vertices added since `first`: scale, then rotate about x, then translate
+void placeVertices(MeshBuilder &b, GLuint first, float tx, float ty, float tz, float rotateX, float sx, float sy, float sz) {
+	float c = cosf(DEG2RAD(rotateX));
+	float s = sinf(DEG2RAD(rotateX));
+	for (size_t v = first * 6; v < b.vertices.size(); v += 6) {
+		GLfloat *p = &b.vertices[v];
+		float x = p[0] * sx, y = p[1] * sy, z = p[2] * sz;
+		p[0] = x + tx;
+		p[1] = c * y - s * z + ty;
+		p[2] = s * y + c * z + tz;
+		float nx = p[3] / sx, ny = p[4] / sy, nz = p[5] / sz;
+		float len = sqrtf(nx * nx + ny * ny + nz * nz);
+		p[3] = nx / len;
+		p[4] = (c * ny - s * nz) / len;
+		p[5] = (s * ny + c * nz) / len;
+	}
+}
+
+constexpr int torusRatio(float innerRadius, float outerRadius) {
+	return (int)(innerRadius / outerRadius * 1000.0f + 0.5f);
+}
+
+// Compile-time tessellations of every primitive the scene draws, at every
+// detail level, plus the tubes of the goal body. They are constant data in
+// the binary; startup only copies them into buffers.
+template <int Slices, int Stacks>
+constexpr MeshTable<(Slices + 1) * (Stacks + 1), Slices * Stacks * 6> sphereTable() {
+	MeshTable<(Slices + 1) * (Stacks + 1), Slices * Stacks * 6> table;
+	buildSphere(table, Slices, Stacks);
+	return table;
+}
+
+template <int Sides, int Rings, int Ratio>
+constexpr MeshTable<(Sides + 1) * (Rings + 1), Sides * Rings * 6> torusTable() {
+	MeshTable<(Sides + 1) * (Rings + 1), Sides * Rings * 6> table;
+	buildTorus(table, Sides, Rings, Ratio / 1000.0f);
+	return table;
+}
+
+template <int Slices, int Stacks>
+constexpr MeshTable<(Slices + 1) * (Stacks + 2) + 1, Slices * Stacks * 6 + Slices * 3> coneTable() {
+	MeshTable<(Slices + 1) * (Stacks + 2) + 1, Slices * Stacks * 6 + Slices * 3> table;
+	buildCone(table, Slices, Stacks);
+	return table;
+}
+
+// Radius and height in thousandths
+template <int Slices, int Stacks, int Radius, int Height>
+constexpr MeshTable<(Slices + 1) * (Stacks + 1), Slices * Stacks * 6> cylinderTable() {
+	MeshTable<(Slices + 1) * (Stacks + 1), Slices * Stacks * 6> table;
+	buildCylinder(table, Radius / 1000.0f, Radius / 1000.0f, Height / 1000.0f, Slices, Stacks);
+	return table;
+}
+
+constexpr MeshTable<24, 36> cubeTable() {
+	MeshTable<24, 36> table;
+	buildCube(table);
+	return table;
+}
+
+template <int Slices, int Stacks>
+constexpr auto SPHERE_TABLE = sphereTable<Slices, Stacks>();
+template <int Sides, int Rings, int Ratio>
+constexpr auto TORUS_TABLE = torusTable<Sides, Rings, Ratio>();
+template <int Slices, int Stacks>
+constexpr auto CONE_TABLE = coneTable<Slices, Stacks>();
+template <int Slices, int Stacks, int Radius, int Height>
+constexpr auto CYLINDER_TABLE = cylinderTable<Slices, Stacks, Radius, Height>();
+constexpr auto CUBE_TABLE = cubeTable();
+
+template <class Table>
+constexpr EmbeddedMesh embedMesh(PrimitiveKey key, const Table &table) {
+	return EmbeddedMesh { key, table.vertices, table.vertexSize, table.indices, table.indexSize };
+}
+
+// For tables baked straight into a larger mesh and never looked up by key
+template <class Table>
+constexpr EmbeddedMesh embedMesh(const Table &table) {
+	return embedMesh(PrimitiveKey(), table);
+}
+
+// Torus ratios of the floodlight stand ring and lens rim, the drone body band
+// and the diver's helmet collar
+constexpr int RATIO_STAND_RING = torusRatio(0.015f, 0.055f);
+constexpr int RATIO_LENS_RIM = torusRatio(0.008f, 0.045f);
+constexpr int RATIO_DRONE_BAND = torusRatio(0.012f, 0.09f);
+constexpr int RATIO_COLLAR = torusRatio(0.015f, 0.07f);
+
+// Full-detail counts first, then what lodDivisions reduces them to
+const EmbeddedMesh EMBEDDED_MESHES[] = {
+	embedMesh({ SHAPE_CUBE, 1, 1, 0 }, CUBE_TABLE),
+	embedMesh({ SHAPE_SPHERE, 4, 4, 0 }, SPHERE_TABLE<4, 4>), // far wall rivets
+	embedMesh({ SHAPE_SPHERE, 8, 8, 0 }, SPHERE_TABLE<8, 8>),
+	embedMesh({ SHAPE_SPHERE, 12, 12, 0 }, SPHERE_TABLE<12, 12>),
+	embedMesh({ SHAPE_SPHERE, 14, 14, 0 }, SPHERE_TABLE<14, 14>),
+	embedMesh({ SHAPE_SPHERE, 16, 16, 0 }, SPHERE_TABLE<16, 16>),
+	embedMesh({ SHAPE_SPHERE, 18, 18, 0 }, SPHERE_TABLE<18, 18>),
+	embedMesh({ SHAPE_SPHERE, 20, 20, 0 }, SPHERE_TABLE<20, 20>),
+	embedMesh({ SHAPE_SPHERE, 22, 22, 0 }, SPHERE_TABLE<22, 22>),
+	embedMesh({ SHAPE_SPHERE, 24, 24, 0 }, SPHERE_TABLE<24, 24>),
+	embedMesh({ SHAPE_SPHERE, 6, 6, 0 }, SPHERE_TABLE<6, 6>),
+	embedMesh({ SHAPE_SPHERE, 7, 7, 0 }, SPHERE_TABLE<7, 7>),
+	embedMesh({ SHAPE_SPHERE, 9, 9, 0 }, SPHERE_TABLE<9, 9>),
+	embedMesh({ SHAPE_SPHERE, 10, 10, 0 }, SPHERE_TABLE<10, 10>),
+	embedMesh({ SHAPE_SPHERE, 11, 11, 0 }, SPHERE_TABLE<11, 11>),
+	embedMesh({ SHAPE_TORUS, 12, 16, RATIO_STAND_RING }, TORUS_TABLE<12, 16, RATIO_STAND_RING>),
+	embedMesh({ SHAPE_TORUS, 10, 16, RATIO_LENS_RIM }, TORUS_TABLE<10, 16, RATIO_LENS_RIM>),
+	embedMesh({ SHAPE_TORUS, 12, 20, RATIO_DRONE_BAND }, TORUS_TABLE<12, 20, RATIO_DRONE_BAND>),
+	embedMesh({ SHAPE_TORUS, 12, 20, RATIO_COLLAR }, TORUS_TABLE<12, 20, RATIO_COLLAR>),
+	embedMesh({ SHAPE_TORUS, 6, 8, RATIO_STAND_RING }, TORUS_TABLE<6, 8, RATIO_STAND_RING>),
+	embedMesh({ SHAPE_TORUS, 6, 8, RATIO_LENS_RIM }, TORUS_TABLE<6, 8, RATIO_LENS_RIM>),
+	embedMesh({ SHAPE_TORUS, 6, 8, RATIO_DRONE_BAND }, TORUS_TABLE<6, 8, RATIO_DRONE_BAND>),
+	embedMesh({ SHAPE_TORUS, 6, 8, RATIO_COLLAR }, TORUS_TABLE<6, 8, RATIO_COLLAR>),
+	embedMesh({ SHAPE_TORUS, 6, 10, RATIO_DRONE_BAND }, TORUS_TABLE<6, 10, RATIO_DRONE_BAND>),
+	embedMesh({ SHAPE_TORUS, 6, 10, RATIO_COLLAR }, TORUS_TABLE<6, 10, RATIO_COLLAR>),
+	embedMesh({ SHAPE_CONE, 20, 1, 0 }, CONE_TABLE<20, 1>),
+	embedMesh({ SHAPE_CONE, 10, 1, 0 }, CONE_TABLE<10, 1>),
+	embedMesh({ SHAPE_CONE, 6, 1, 0 }, CONE_TABLE<6, 1>)
+};
+const int EMBEDDED_MESH_COUNT = sizeof(EMBEDDED_MESHES) / sizeof(EMBEDDED_MESHES[0]);
+
+const EmbeddedMesh *findEmbeddedMesh(const PrimitiveKey &key) {
+	for (int i = 0; i < EMBEDDED_MESH_COUNT; ++i) {
+		const PrimitiveKey &k = EMBEDDED_MESHES[i].key;
+		if (k.shape == key.shape && k.slices == key.slices && k.stacks == key.stacks && k.ratio == key.ratio) {
+			return &EMBEDDED_MESHES[i];
+		}
+	}
+	return NULL;
+}
+
+// Draw workers call this too, so after startup it may only look meshes up:
+// building one needs the GL context and would race on the map.
+const Mesh &primitiveMesh(PrimitiveShape shape, int slices, int stacks, int ratio) {
+	PrimitiveKey key = { shape, slices, stacks, ratio };
+	std::map<PrimitiveKey, Mesh>::iterator it = primitiveMeshes.find(key);
+	if (it != primitiveMeshes.end()) {
+		return it->second;
+	}
+	if (primitiveMeshesFrozen) {
+		fprintf(stderr, "Primitive mesh (shape %d, %dx%d, ratio %d) was not built by initPrimitiveMeshes\n", (int)shape, slices, stacks, ratio);
+		abort();
+	}
+	MeshBuilder builder;
+	const EmbeddedMesh *embedded = findEmbeddedMesh(key);
+	if (embedded) {
+		builder.append(*embedded);
+		boundMesh = NULL;
+		return primitiveMeshes[key] = builder.upload();
+	}
+	switch (shape) {
+	case SHAPE_CUBE:
+		buildCube(builder);
+		break;
+	case SHAPE_SPHERE:
+		buildSphere(builder, slices, stacks);
+		break;
+	case SHAPE_TORUS:
+		buildTorus(builder, slices, stacks, ratio / 1000.0f);
+		break;
+	case SHAPE_CONE:
+		buildCone(builder, slices, stacks);
+		break;
+	}
+	boundMesh = NULL;
+	return primitiveMeshes[key] = builder.upload();
+}
+
+void bindMesh(const Mesh &mesh) {
+	if (boundMesh != &mesh) {
+		bindArrayBuffer(mesh.vertexBuffer);
+		bindElementBuffer(mesh.indexBuffer);
+		glVertexPointer(3, GL_FLOAT, 6 * sizeof(GLfloat), (const GLvoid *)0);
+		glNormalPointer(GL_FLOAT, 6 * sizeof(GLfloat), (const GLvoid *)(3 * sizeof(GLfloat)));
+		setColorArray(mesh.colorOffset != 0);
+		if (mesh.colorOffset) {
+			glColorPointer(3, GL_FLOAT, 0, (const GLvoid *)mesh.colorOffset);
+		}
+		boundMesh = &mesh;
+	}
+}
+
+void recordMesh(const Mesh &mesh);
+
+void drawMesh(const Mesh &mesh) {
+	if (renderQueue.recording) {
+		recordMesh(mesh);
+		return;
+	}
+	bindMesh(mesh);
+	glDrawElements(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT, (const GLvoid *)0);
+	countDraw(mesh.indexCount);
+}
+
+void drawScaledMesh(const Mesh &mesh, float sx, float sy, float sz) {
+	if (sx == 1.0f && sy == 1.0f && sz == 1.0f) {
+		drawMesh(mesh);
+		return;
+	}
+	pushMatrix();
+	scaleMatrix(sx, sy, sz);
+	drawMesh(mesh);
+	popMatrix();
+}
+
+// Sort key, most significant bit first. Opaque: 0, lighting off, mesh, depth
+// ascending. Transparent: 1, depth descending; parts at the same depth (a
+// goal's core and glow) keep the order they were drawn in, since the sort is
+// stable. Depth is the view-space distance of the packet's origin, quantized
+// over the far plane. Meshes with their own vertex colors are always opaque.
+unsigned long long renderKey(const RenderPacket &packet) {
+	const float *m = packet.model;
+	float depth = -(viewMatrix[2] * m[12] + viewMatrix[6] * m[13] + viewMatrix[10] * m[14] + viewMatrix[14]);
+	depth = std::max(0.0f, std::min(depth / CAMERA_FAR, 1.0f));
+	unsigned long long quantized = (unsigned long long)(depth * 4294967295.0);
+	unsigned long long unlit = packet.lighting ? 0 : 1;
+	unsigned long long mesh = packet.mesh->vertexBuffer & 0x3fffffffu;
+	if (packet.color[3] < 1.0f && !packet.mesh->colorOffset) {
+		return (1ull << 63) | ((0xffffffffull - quantized) << 31);
+	}
+	return (unlit << 62) | (mesh << 32) | quantized;
+}
+
+void recordMesh(const Mesh &mesh) {
+	RenderPacket packet;
+	packet.mesh = &mesh;
+	memcpy(packet.model, renderQueue.matrix, sizeof(packet.model));
+	memcpy(packet.color, renderQueue.color, sizeof(packet.color));
+	packet.lighting = renderQueue.lighting;
+	packet.key = renderKey(packet);
+	renderQueue.packets.push_back(packet);
+}
+
+void beginRenderQueue() {
+	renderQueue.recording = true;
+	renderQueue.depth = 0;
+	identityMatrix(renderQueue.matrix);
+	renderQueue.color[0] = renderQueue.color[1] = renderQueue.color[2] = renderQueue.color[3] = 1.0f;
+	renderQueue.lighting = true;
+}
+
+bool comparePackets(const RenderPacket &a, const RenderPacket &b) {
+	return a.key < b.key;
+}
+
+bool drawShaderPackets(const RenderPacket *packets, size_t count);
+
+// Loads view * model into the GL modelview; the caller restores viewMatrix
+void loadModelMatrix(const float model[16]) {
+	float modelView[16];
+	multiplyMatrix(viewMatrix, model, modelView);
+	glLoadMatrixf(modelView);
+}
+
+// Stops recording and submits the queued packets in key order, through the
+// shader renderer when it is active. With opaqueOnly the transparent packets
+// stay queued for a later call.
+void executeRenderQueue(bool opaqueOnly) {
+	TraceScope trace("executeRenderQueue");
+	renderQueue.recording = false;
+	std::vector<RenderPacket> &packets = renderQueue.packets;
+	std::stable_sort(packets.begin(), packets.end(), comparePackets);
+	size_t count = 0;
+	while (count < packets.size() && !(opaqueOnly && (packets[count].key >> 63))) {
+		++count;
+	}
+	if (drawShaderPackets(packets.data(), count)) {
+		packets.erase(packets.begin(), packets.begin() + count);
+		return;
+	}
+	bool lighting = true;
+	for (size_t i = 0; i < count; ++i) {
+		const RenderPacket &packet = packets[i];
+		if (packet.lighting != lighting) {
+			lighting = packet.lighting;
+			if (lighting) {
+				enableCap(GL_LIGHTING);
+			} else {
+				disableCap(GL_LIGHTING);
+			}
+		}
+		setDrawColor(packet.color[0], packet.color[1], packet.color[2], packet.color[3]);
+		loadModelMatrix(packet.model);
+		drawMesh(*packet.mesh);
+	}
+	packets.erase(packets.begin(), packets.begin() + count);
+	if (!lighting) {
+		enableCap(GL_LIGHTING);
+	}
+	glLoadMatrixf(viewMatrix);
+}
+
+void solidCube(float size) {
+	drawScaledMesh(primitiveMesh(SHAPE_CUBE, 1, 1, 0), size, size, size);
+}
+
+// Unit sphere and torus (outer radius 1) for the current LOD level
+const Mesh &sphereMesh(int slices, int stacks) {
+	return primitiveMesh(SHAPE_SPHERE, lodDivisions(slices, 6), lodDivisions(stacks, 6), 0);
+}
+
+const Mesh &torusMesh(float innerRadius, float outerRadius, int sides, int rings) {
+	return primitiveMesh(SHAPE_TORUS, lodDivisions(sides, 6), lodDivisions(rings, 8), torusRatio(innerRadius, outerRadius));
+}
+
+void solidCone(float base, float height, int slices, int stacks) {
+	drawScaledMesh(primitiveMesh(SHAPE_CONE, lodDivisions(slices, 6), lodDivisions(stacks, 1), 0), base, base, height);
+}
+
+// Tessellate every variant the models use, at every detail level, up front so
+// no frame pays for it
+void initPrimitiveMeshes() {
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	primitiveMesh(SHAPE_CUBE, 1, 1, 0);
+	primitiveMesh(SHAPE_SPHERE, WALL_RIVET_SLICES_FAR, WALL_RIVET_SLICES_FAR, 0);
+	const int sphereDetail[] = { 8, 12, 14, 16, 18, 20, 22, 24 };
+	for (int level = LOD_FULL; level <= LOD_COARSE; ++level) {
+		lodLevel = (LodLevel)level;
+		for (size_t i = 0; i < sizeof(sphereDetail) / sizeof(sphereDetail[0]); ++i) {
+			primitiveMesh(SHAPE_SPHERE, lodDivisions(sphereDetail[i], 6), lodDivisions(sphereDetail[i], 6), 0);
+		}
+		primitiveMesh(SHAPE_TORUS, lodDivisions(12, 6), lodDivisions(16, 8), RATIO_STAND_RING);
+		primitiveMesh(SHAPE_TORUS, lodDivisions(10, 6), lodDivisions(16, 8), RATIO_LENS_RIM);
+		primitiveMesh(SHAPE_TORUS, lodDivisions(12, 6), lodDivisions(20, 8), RATIO_DRONE_BAND);
+		primitiveMesh(SHAPE_TORUS, lodDivisions(12, 6), lodDivisions(20, 8), RATIO_COLLAR);
+		primitiveMesh(SHAPE_CONE, lodDivisions(20, 6), lodDivisions(1, 1), 0);
+	}
+	lodLevel = LOD_FULL;
+}
+
+bool hasExtension(const char *name) {
+	const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+	if (!extensions) {
+		return false;
+	}
+	size_t length = strlen(name);
+	for (const char *p = strstr(extensions, name); p; p = strstr(p + length, name)) {
+		if ((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0')) {
+			return true;
+		}
+	}
+	return false;
+}
+
+GLuint compileShader(GLenum type, const char *source) {
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &source, NULL);
+	glCompileShader(shader);
+	GLint ok = GL_FALSE;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+	if (!ok) {
+		char log[1024];
+		glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+		fprintf(stderr, "Shader compile failed: %s\n", log);
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+// Links a program; attribute locations must be bound by the caller first
+bool linkProgram(GLuint program) {
+	glLinkProgram(program);
+	GLint ok = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &ok);
+	if (!ok) {
+		char log[1024];
+		glGetProgramInfoLog(program, sizeof(log), NULL, log);
+		fprintf(stderr, "Program link failed: %s\n", log);
+	}
+	return ok == GL_TRUE;
+}
+
+// Shader renderer: an alternative to the fixed-function submission of the
+// render queue. Camera, lights, material and fog go into one uniform buffer,
+// each packet becomes a record in an instance buffer (model matrix, normal
+// matrix, color, lighting flag), and the whole queue is drawn out of the
+// shared mesh pool with one glMultiDrawElementsIndirect. Consecutive packets
+// of the same mesh share a command. The shaders reproduce the fixed-function
+// per-vertex lighting and linear fog, so both backends give the same picture;
+// --renderer fixed selects the old path for comparison. The ground, walls,
+// occlusion boxes and HUD stay on their existing paths.
+enum RendererBackend {
+	RENDERER_FIXED,
+	RENDERER_SHADER
+};
+
+// Per-frame data, laid out to match the std140 FrameData block
+struct FrameUniforms {
+	GLfloat view[16];
+	GLfloat projection[16];
+	GLfloat lightPosition[MAX_SCENE_LIGHTS][4]; // eye space
+	GLfloat lightDiffuse[MAX_SCENE_LIGHTS][4];
+	GLfloat lightSpecular[MAX_SCENE_LIGHTS][4];
+	GLfloat lightAttenuation[MAX_SCENE_LIGHTS][4]; // constant, linear, quadratic
+	GLfloat fogColor[4];
+	GLfloat fogRange[4]; // end, 1 / (end - start)
+	GLfloat material[4]; // specular rgb, shininess
+};
+
+struct DrawElementsCommand {
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+struct ShaderRenderer {
+	bool active;
+	GLuint program;
+	GLuint vertexArray;
+	GLuint vertexBuffer; // mesh pool
+	GLuint indexBuffer;
+	GLuint instanceBuffer;
+	GLuint indirectBuffer;
+	GLuint frameBuffer; // FrameData uniform buffer
+	size_t poolVertices; // pool size at the last upload
+	size_t poolIndices;
+	bool frameKnown;
+	FrameUniforms frame; // last uploaded
+	std::vector<GLfloat> instances;
+	std::vector<DrawElementsCommand> commands;
+};
+
+ShaderRenderer shaderRenderer;
+RendererBackend requestedRenderer = RENDERER_SHADER;
+
+const GLuint PACKET_ATTRIB_MODEL = 3;  // mat4, locations 3-6
+const GLuint PACKET_ATTRIB_NORMAL = 7; // mat3, locations 7-9
+const GLuint PACKET_ATTRIB_COLOR = 10;
+const GLuint PACKET_ATTRIB_LIGHTING = 11;
+const int PACKET_INSTANCE_FLOATS = 30;
+
+const char *FRAME_DATA_BLOCK =
+	"layout(std140) uniform FrameData {\n"
+	"	mat4 view;\n"
+	"	mat4 projection;\n"
+	"	vec4 lightPosition[8];\n"
+	"	vec4 lightDiffuse[8];\n"
+	"	vec4 lightSpecular[8];\n"
+	"	vec4 lightAttenuation[8];\n"
+	"	vec4 fogColor;\n"
+	"	vec4 fogRange;\n"
+	"	vec4 material;\n"
+	"};\n";
+
+// Fixed-function lighting with GL_COLOR_MATERIAL, GL's default 0.2 light
+// model ambient and an infinite viewer, evaluated per vertex as GL does. The
+// light loop is unrolled for the scene's light count.
+const char *PACKET_VERTEX_SHADER =
+	"layout(location = 0) in vec3 position;\n"
+	"layout(location = 1) in vec3 normal;\n"
+	"layout(location = 2) in vec4 vertexColor; // alpha 0 when the mesh has no colors\n"
+	"layout(location = 3) in mat4 instanceModel;\n"
+	"layout(location = 7) in mat3 instanceNormal;\n"
+	"layout(location = 10) in vec4 instanceColor;\n"
+	"layout(location = 11) in float instanceLighting;\n"
+	"out vec4 color;\n"
+	"out float fog;\n"
+	"void main() {\n"
+	"	vec4 eye = view * (instanceModel * vec4(position, 1.0));\n"
+	"	vec4 base = mix(instanceColor, vec4(vertexColor.rgb, 1.0), vertexColor.a);\n"
+	"	color = base;\n"
+	"	if (instanceLighting > 0.5) {\n"
+	"		vec3 n = normalize(mat3(view) * (instanceNormal * normal));\n"
+	"		vec3 lit = base.rgb * 0.2;\n"
+	"		for (int i = 0; i < LIGHT_COUNT; ++i) {\n"
+	"			vec3 toLight = lightPosition[i].xyz - eye.xyz * lightPosition[i].w;\n"
+	"			float d = length(toLight);\n"
+	"			vec3 l = toLight / d;\n"
+	"			float att = lightPosition[i].w == 0.0 ? 1.0 : 1.0 / dot(lightAttenuation[i].xyz, vec3(1.0, d, d * d));\n"
+	"			float nDotL = max(dot(n, l), 0.0);\n"
+	"			vec3 term = base.rgb * lightDiffuse[i].rgb * nDotL;\n"
+	"			if (nDotL > 0.0) {\n"
+	"				float nDotH = max(dot(n, normalize(l + vec3(0.0, 0.0, 1.0))), 0.0);\n"
+	"				term += material.rgb * lightSpecular[i].rgb * pow(nDotH, material.w);\n"
+	"			}\n"
+	"			lit += att * term;\n"
+	"		}\n"
+	"		color = clamp(vec4(lit, base.a), 0.0, 1.0);\n"
+	"	}\n"
+	"	fog = (fogRange.x - abs(eye.z)) * fogRange.y;\n"
+	"	gl_Position = projection * eye;\n"
+	"}\n";
+
+const char *PACKET_FRAGMENT_SHADER =
+	"in vec4 color;\n"
+	"in float fog;\n"
+	"out vec4 fragColor;\n"
+	"void main() {\n"
+	"	fragColor = vec4(mix(fogColor.rgb, color.rgb, clamp(fog, 0.0, 1.0)), color.a);\n"
+	"}\n";
+
+// Inverse transpose of the upper 3x3, column-major, for transforming normals
+void normalMatrix(const float m[16], float out[9]) {
+	float cofactor[9];
+	for (int c = 0; c < 3; ++c) {
+		for (int r = 0; r < 3; ++r) {
+			int r1 = (r + 1) % 3, r2 = (r + 2) % 3, c1 = (c + 1) % 3, c2 = (c + 2) % 3;
+			cofactor[c * 3 + r] = m[c1 * 4 + r1] * m[c2 * 4 + r2] - m[c2 * 4 + r1] * m[c1 * 4 + r2];
+		}
+	}
+	float det = m[0] * cofactor[0] + m[4] * cofactor[3] + m[8] * cofactor[6];
+	float scale = det != 0.0f ? 1.0f / det : 0.0f;
+	for (int i = 0; i < 9; ++i) {
+		out[i] = cofactor[i] * scale;
+	}
+}
+
+#if !defined(__APPLE__)
+// Prepends the version, the scene's light count and the FrameData block
+GLuint compilePacketShader(GLenum type, const char *body) {
+	char header[64];
+	snprintf(header, sizeof(header), "#version 330\n#define LIGHT_COUNT %u\n", scene.lightCount);
+	std::string source = std::string(header) + FRAME_DATA_BLOCK + body;
+	return compileShader(type, source.c_str());
+}
+
+// Needs GLSL 3.30 and multi-draw indirect with base instances (GL 4.3, or
+// the ARB extensions). The shaders stay within the core profile; they run in
+// the compatibility context GLUT and EGL hand out so the fixed-function
+// ground, walls and HUD keep working alongside.
+void initShaderRenderer() {
+	shaderRenderer.active = false;
+	if (requestedRenderer != RENDERER_SHADER) {
+		return;
+	}
+	double version = atof((const char *)glGetString(GL_VERSION));
+	bool multiDraw = version >= 4.3 || (version >= 3.3 && hasExtension("GL_ARB_multi_draw_indirect") && hasExtension("GL_ARB_base_instance"));
+	if (!multiDraw) {
+		fprintf(stderr, "Shader renderer needs GL 4.3 or ARB_multi_draw_indirect; using fixed function\n");
+		return;
+	}
+	GLuint vertexShader = compilePacketShader(GL_VERTEX_SHADER, PACKET_VERTEX_SHADER);
+	GLuint fragmentShader = compilePacketShader(GL_FRAGMENT_SHADER, PACKET_FRAGMENT_SHADER);
+	GLuint program = glCreateProgram();
+	if (vertexShader && fragmentShader) {
+		glAttachShader(program, vertexShader);
+		glAttachShader(program, fragmentShader);
+	}
+	bool linked = vertexShader && fragmentShader && linkProgram(program);
+	glDeleteShader(vertexShader);
+	glDeleteShader(fragmentShader);
+	if (!linked) {
+		glDeleteProgram(program);
+		return;
+	}
+	shaderRenderer.program = program;
+	glUniformBlockBinding(program, glGetUniformBlockIndex(program, "FrameData"), 0);
+
+	GLuint buffers[5];
+	glGenBuffers(5, buffers);
+	shaderRenderer.vertexBuffer = buffers[0];
+	shaderRenderer.indexBuffer = buffers[1];
+	shaderRenderer.instanceBuffer = buffers[2];
+	shaderRenderer.indirectBuffer = buffers[3];
+	shaderRenderer.frameBuffer = buffers[4];
+	glBindBuffer(GL_UNIFORM_BUFFER, shaderRenderer.frameBuffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), NULL, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, 0, shaderRenderer.frameBuffer);
+	shaderRenderer.frameKnown = false;
+
+	// The element binding is vertex array state, so it is set here once and
+	// never touches the cached binding of the default vertex array
+	glGenVertexArrays(1, &shaderRenderer.vertexArray);
+	glBindVertexArray(shaderRenderer.vertexArray);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, shaderRenderer.indexBuffer);
+	GLsizei stride = POOL_VERTEX_FLOATS * sizeof(GLfloat);
+	bindArrayBuffer(shaderRenderer.vertexBuffer);
+	for (GLuint i = 0; i < 3; ++i) {
+		glEnableVertexAttribArray(i);
+	}
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (const GLvoid *)0);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (const GLvoid *)(3 * sizeof(GLfloat)));
+	glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, stride, (const GLvoid *)(6 * sizeof(GLfloat)));
+	stride = PACKET_INSTANCE_FLOATS * sizeof(GLfloat);
+	bindArrayBuffer(shaderRenderer.instanceBuffer);
+	for (GLuint i = PACKET_ATTRIB_MODEL; i <= PACKET_ATTRIB_LIGHTING; ++i) {
+		glEnableVertexAttribArray(i);
+		glVertexAttribDivisor(i, 1);
+	}
+	for (GLuint i = 0; i < 4; ++i) {
+		glVertexAttribPointer(PACKET_ATTRIB_MODEL + i, 4, GL_FLOAT, GL_FALSE, stride, (const GLvoid *)(i * 4 * sizeof(GLfloat)));
+	}
+	for (GLuint i = 0; i < 3; ++i) {
+		glVertexAttribPointer(PACKET_ATTRIB_NORMAL + i, 3, GL_FLOAT, GL_FALSE, stride, (const GLvoid *)((16 + i * 3) * sizeof(GLfloat)));
+	}
+	glVertexAttribPointer(PACKET_ATTRIB_COLOR, 4, GL_FLOAT, GL_FALSE, stride, (const GLvoid *)(25 * sizeof(GLfloat)));
+	glVertexAttribPointer(PACKET_ATTRIB_LIGHTING, 1, GL_FLOAT, GL_FALSE, stride, (const GLvoid *)(29 * sizeof(GLfloat)));
+	glBindVertexArray(0);
+	shaderRenderer.poolVertices = shaderRenderer.poolIndices = 0;
+	shaderRenderer.active = true;
+}
+
+// Meshes built after startup (a tessellation no model asked for up front)
+// grow the pool; the buffers are then uploaded again whole
+void uploadMeshPool() {
+	size_t vertices = meshPool.vertices.size() / POOL_VERTEX_FLOATS;
+	if (vertices == shaderRenderer.poolVertices && meshPool.indices.size() == shaderRenderer.poolIndices) {
+		return;
+	}
+	bindArrayBuffer(shaderRenderer.vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, meshPool.vertices.size() * sizeof(GLfloat), meshPool.vertices.data(), GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, meshPool.indices.size() * sizeof(GLuint), meshPool.indices.data(), GL_STATIC_DRAW);
+	shaderRenderer.poolVertices = vertices;
+	shaderRenderer.poolIndices = meshPool.indices.size();
+	countStateChanges(1);
+}
+
+// Re-sent only when the camera moved since the last upload
+void uploadFrameUniforms() {
+	FrameUniforms frame;
+	memset(&frame, 0, sizeof(frame));
+	memcpy(frame.view, viewMatrix, sizeof(frame.view));
+	memcpy(frame.projection, projectionMatrix, sizeof(frame.projection));
+	for (unsigned int i = 0; i < scene.lightCount; ++i) {
+		const SceneLightRecord &light = scene.lights[i];
+		transformVector(viewMatrix, light.position, frame.lightPosition[i]);
+		memcpy(frame.lightDiffuse[i], light.diffuse, sizeof(frame.lightDiffuse[i]));
+		memcpy(frame.lightSpecular[i], light.specular, sizeof(frame.lightSpecular[i]));
+		memcpy(frame.lightAttenuation[i], light.attenuation, sizeof(light.attenuation));
+	}
+	memcpy(frame.fogColor, FOG_COLOR, sizeof(frame.fogColor));
+	frame.fogRange[0] = FOG_END;
+	frame.fogRange[1] = 1.0f / (FOG_END - FOG_START);
+	memcpy(frame.material, MATERIAL_SPECULAR, 3 * sizeof(GLfloat));
+	frame.material[3] = MATERIAL_SHININESS;
+	if (shaderRenderer.frameKnown && memcmp(&frame, &shaderRenderer.frame, sizeof(frame)) == 0) {
+		countDroppedState(1);
+		return;
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, shaderRenderer.frameBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frame), &frame);
+	shaderRenderer.frame = frame;
+	shaderRenderer.frameKnown = true;
+	countStateChanges(1);
+}
+
+// Draws sorted packets with one multi-draw; false when the shader renderer
+// is off and the caller should submit them itself
+bool drawShaderPackets(const RenderPacket *packets, size_t count) {
+	if (!shaderRenderer.active) {
+		return false;
+	}
+	if (count == 0) {
+		return true;
+	}
+	std::vector<GLfloat> &instances = shaderRenderer.instances;
+	std::vector<DrawElementsCommand> &commands = shaderRenderer.commands;
+	instances.resize(count * PACKET_INSTANCE_FLOATS);
+	commands.clear();
+	long long indices = 0;
+	for (size_t i = 0; i < count; ++i) {
+		const RenderPacket &packet = packets[i];
+		GLfloat *instance = &instances[i * PACKET_INSTANCE_FLOATS];
+		memcpy(instance, packet.model, 16 * sizeof(GLfloat));
+		normalMatrix(packet.model, instance + 16);
+		memcpy(instance + 25, packet.color, 4 * sizeof(GLfloat));
+		instance[29] = packet.lighting ? 1.0f : 0.0f;
+		const Mesh &mesh = *packet.mesh;
+		indices += mesh.indexCount;
+		if (i > 0 && packets[i - 1].mesh == &mesh) {
+			++commands.back().instanceCount;
+			continue;
+		}
+		DrawElementsCommand command = { (GLuint)mesh.indexCount, 1, mesh.firstIndex, mesh.baseVertex, (GLuint)i };
+		commands.push_back(command);
+	}
+
+	glBindVertexArray(shaderRenderer.vertexArray);
+	countStateChanges(1);
+	uploadMeshPool();
+	uploadFrameUniforms();
+	bindArrayBuffer(shaderRenderer.instanceBuffer);
+	glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(GLfloat), instances.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, shaderRenderer.indirectBuffer);
+	countStateChanges(1);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsCommand), commands.data(), GL_STREAM_DRAW);
+	useProgram(shaderRenderer.program);
+	glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const GLvoid *)0, (GLsizei)commands.size(), 0);
+	countDraw(indices);
+	useProgram(0);
+	glBindVertexArray(0);
+	countStateChanges(1);
+	return true;
+}
+#else
+// The legacy macOS context stops at GL 2.1, so the fixed-function path is
+// always used there
+void initShaderRenderer() {
+	shaderRenderer.active = false;
+}
+
+bool drawShaderPackets(const RenderPacket *, size_t) {
+	return false;
+}
+#endif
+
+// The goal pickup's static parts share one colored mesh; only the glowing
+// core pulses, which is a scale on the cached sphere meshes.
+Mesh goalBodyMesh;
+
+void initGoalMesh() {
+	MeshBuilder b;
+	GLuint first;
+	
+	// Outer containment cylinder
+	b.setColor(0.3f, 0.35f, 0.4f);
+	first = b.vertexCount();
+	b.append(embedMesh(CYLINDER_TABLE<20, 4, 60, 180>));
+	placeVertices(b, first, 0.0f, 0.0f, 0.0f, 90.0f, 1.0f, 1.0f, 1.0f);
+	
+	// Top and bottom caps
+	first = b.vertexCount();
+	b.append(embedMesh(CONE_TABLE<20, 1>));
+	placeVertices(b, first, 0.0f, 0.09f, 0.0f, 90.0f, 0.062f, 0.062f, 0.02f);
+	first = b.vertexCount();
+	b.append(embedMesh(CONE_TABLE<20, 1>));
+	placeVertices(b, first, 0.0f, -0.09f, 0.0f, -90.0f, 0.062f, 0.062f, 0.02f);
+	
+	// Support stand
+	b.setColor(0.25f, 0.28f, 0.32f);
+	first = b.vertexCount();
+	b.append(embedMesh(CYLINDER_TABLE<12, 2, 25, 40>));
+	placeVertices(b, first, 0.0f, -0.12f, 0.0f, 90.0f, 1.0f, 1.0f, 1.0f);
+	
+	// Base platform
+	first = b.vertexCount();
+	b.append(embedMesh(CUBE_TABLE));
+	placeVertices(b, first, 0.0f, -0.14f, 0.0f, 0.0f, 0.08f, 0.015f, 0.08f);
+	
+	goalBodyMesh = b.upload();
+	boundMesh = NULL;
+}
+
+// Transform hierarchy for the props, the goals and the player. Each model is
+// a table of parts. A part hangs from an earlier part, or from the model root,
+// by a translation and an optional fixed rotation. Its scale shapes only its
+// own mesh, never its children. Parts that nothing animates get their
+// model-space matrix once at startup, shared by every instance. A part may
+// also carry one motion, driven by an animation value (a channel) of the
+// instance. A rotating or pulsing part and everything below it are rebuilt
+// into the instance's RigPose, and only when its channels changed. A shift
+// under a static parent moves its subtree without changing any matrix, so it
+// is added to the position at record time instead. Recording moves each
+// matrix to the instance's position and queues it; no matrix stack is
+// touched.
+enum PartMesh {
+	PART_GROUP, // no mesh; only carries a transform for its children
+	PART_CUBE,
+	PART_SPHERE,
+	PART_TORUS,
+	PART_GOAL_BODY
+};
+
+enum PartMotion {
+	MOTION_NONE,
+	MOTION_SHIFT_X,  // channel added to the x translation
+	MOTION_SHIFT_Y,
+	MOTION_ROTATE_X, // channel degrees, after the translation
+	MOTION_ROTATE_Y,
+	MOTION_ROTATE_Z,
+	MOTION_PULSE_XZ, // channel multiplies the x and z scale
+	MOTION_PULSE     // channel multiplies the mesh size
+};
+
+enum PartFlag {
+	PART_DETAIL = 1 << 0, // skipped from LOD_COARSE on, like lodDetail()
+	PART_BODY = 1 << 1,   // skipped at LOD_IMPOSTOR
+	PART_UNLIT = 1 << 2
+};
+
+struct RigPart {
+	int parent; // an earlier part, or -1 for the model root
+	float translate[3];
+	float rotate[4]; // fixed rotation: degrees, then the axis
+	float scale[3];
+	PartMesh mesh;
+	int slices;  // sides for a torus
+	int stacks;  // rings for a torus
+	float size;  // sphere radius or torus outer radius
+	float inner; // torus inner radius
+	float color[4];
+	int flags; // PartFlag bits
+	PartMotion motion;
+	int channel;
+	float gain; // scales the channel
+};
+
+const int RIG_MAX_PARTS = 16;
+const int RIG_MAX_CHANNELS = 2;
+
+struct Rig {
+	const char *name; // trace label
+	const RigPart *parts;
+	int partCount;
+	bool animated[RIG_MAX_PARTS]; // the part or one above it rotates or pulses
+	int slot[RIG_MAX_PARTS];      // where an animated part's matrix sits in a pose, or -1
+	int slotCount;
+	float shiftAxis[RIG_MAX_PARTS][3]; // model-space direction of a static part's shift
+	float frames[RIG_MAX_PARTS][16]; // static parts: model space, without the part's scale
+	float models[RIG_MAX_PARTS][16]; // static parts: what the mesh is drawn with
+	const Mesh *meshes[RIG_MAX_PARTS][LOD_COARSE + 1];
+};
+
+// One instance's channels and the matrices of its rig's animated parts, in
+// slot order
+struct RigPose {
+	const Rig *rig; // NULL until first posed
+	float channels[RIG_MAX_CHANNELS];
+	float models[RIG_MAX_PARTS][16];
+};
+
+const RigPart FLOODLIGHT_PARTS[] = {
+	// Base plate and corners
+	{ -1, { 0.0f, 0.0f, 0.0f }, { 0.0f }, { 0.18f, 0.04f, 0.18f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.18f, 0.2f, 0.22f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ -1, { 0.07f, 0.025f, 0.0f }, { 0.0f }, { 0.03f, 0.05f, 0.03f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.15f, 0.17f, 0.19f, 1.0f }, PART_DETAIL, MOTION_NONE, 0, 0.0f },
+	{ -1, { 0.0f, 0.025f, 0.07f }, { 0.0f }, { 0.03f, 0.05f, 0.03f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.15f, 0.17f, 0.19f, 1.0f }, PART_DETAIL, MOTION_NONE, 0, 0.0f },
+	{ -1, { -0.07f, 0.025f, 0.0f }, { 0.0f }, { 0.03f, 0.05f, 0.03f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.15f, 0.17f, 0.19f, 1.0f }, PART_DETAIL, MOTION_NONE, 0, 0.0f },
+	{ -1, { 0.0f, 0.025f, -0.07f }, { 0.0f }, { 0.03f, 0.05f, 0.03f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.15f, 0.17f, 0.19f, 1.0f }, PART_DETAIL, MOTION_NONE, 0, 0.0f },
+	// Stand, ring and top mounting plate
+	{ -1, { 0.0f, 0.12f, 0.0f }, { 0.0f }, { 0.08f, 0.24f, 0.08f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.18f, 0.2f, 0.22f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ -1, { 0.0f, 0.15f, 0.0f }, { 0.0f }, { 1.0f, 1.0f, 1.0f }, PART_TORUS, 12, 16, 0.055f, 0.015f, { 0.3f, 0.35f, 0.4f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ -1, { 0.0f, 0.25f, 0.0f }, { 0.0f }, { 0.14f, 0.04f, 0.14f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.18f, 0.2f, 0.22f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	// Rotating head: housing, side vents, lens and lens rim
+	{ -1, { 0.0f, 0.27f, 0.0f }, { 0.0f }, { 1.0f, 1.0f, 1.0f }, PART_GROUP, 0, 0, 1.0f, 0.0f, { 0.0f }, 0, MOTION_ROTATE_Y, 0, 1.0f },
+	{ 8, { 0.0f, 0.0f, 0.0f }, { 0.0f }, { 0.12f, 0.06f, 0.2f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.24f, 0.3f, 0.35f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ 8, { 0.065f, 0.0f, 0.05f }, { 0.0f }, { 0.015f, 0.05f, 0.06f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.15f, 0.2f, 0.25f, 1.0f }, PART_DETAIL, MOTION_NONE, 0, 0.0f },
+	{ 8, { -0.065f, 0.0f, 0.05f }, { 0.0f }, { 0.015f, 0.05f, 0.06f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.15f, 0.2f, 0.25f, 1.0f }, PART_DETAIL, MOTION_NONE, 0, 0.0f },
+	{ 8, { 0.0f, 0.01f, 0.08f }, { 0.0f }, { 0.08f, 0.06f, 0.08f }, PART_SPHERE, 20, 20, 0.8f, 0.0f, { 0.65f, 0.85f, 0.9f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ 8, { 0.0f, 0.01f, 0.11f }, { 90.0f, 1.0f, 0.0f, 0.0f }, { 1.0f, 1.0f, 1.0f }, PART_TORUS, 10, 16, 0.045f, 0.008f, { 0.2f, 0.25f, 0.3f, 1.0f }, PART_DETAIL, MOTION_NONE, 0, 0.0f }
+};
+
+// Channel 0 is the door opening, applied in opposite directions
+const RigPart AIRLOCK_PARTS[] = {
+	// Frame pillars and top
+	{ -1, { -0.22f, 0.3f, 0.0f }, { 0.0f }, { 0.08f, 0.6f, 0.4f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.25f, 0.3f, 0.35f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ -1, { 0.22f, 0.3f, 0.0f }, { 0.0f }, { 0.08f, 0.6f, 0.4f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.25f, 0.3f, 0.35f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ -1, { 0.0f, 0.6f, 0.0f }, { 0.0f }, { 0.44f, 0.06f, 0.4f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.25f, 0.3f, 0.35f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	// Frame reinforcement bolts
+	{ -1, { -0.22f, 0.55f, 0.21f }, { 0.0f }, { 0.025f, 0.025f, 0.02f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.4f, 0.45f, 0.5f, 1.0f }, PART_DETAIL, MOTION_NONE, 0, 0.0f },
+	{ -1, { 0.22f, 0.55f, 0.21f }, { 0.0f }, { 0.025f, 0.025f, 0.02f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.4f, 0.45f, 0.5f, 1.0f }, PART_DETAIL, MOTION_NONE, 0, 0.0f },
+	{ -1, { -0.22f, 0.05f, 0.21f }, { 0.0f }, { 0.025f, 0.025f, 0.02f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.4f, 0.45f, 0.5f, 1.0f }, PART_DETAIL, MOTION_NONE, 0, 0.0f },
+	{ -1, { 0.22f, 0.05f, 0.21f }, { 0.0f }, { 0.025f, 0.025f, 0.02f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.4f, 0.45f, 0.5f, 1.0f }, PART_DETAIL, MOTION_NONE, 0, 0.0f },
+	// Door panels and their windows
+	{ -1, { 0.0f, 0.3f, 0.0f }, { 0.0f }, { 0.16f, 0.5f, 0.32f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.35f, 0.52f, 0.6f, 1.0f }, 0, MOTION_SHIFT_X, 0, -1.0f },
+	{ -1, { 0.0f, 0.35f, 0.165f }, { 0.0f }, { 0.1f, 0.2f, 0.02f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.5f, 0.75f, 0.85f, 1.0f }, 0, MOTION_SHIFT_X, 0, -1.0f },
+	{ -1, { 0.0f, 0.3f, 0.0f }, { 0.0f }, { 0.16f, 0.5f, 0.32f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.35f, 0.52f, 0.6f, 1.0f }, 0, MOTION_SHIFT_X, 0, 1.0f },
+	{ -1, { 0.0f, 0.35f, 0.165f }, { 0.0f }, { 0.1f, 0.2f, 0.02f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.5f, 0.75f, 0.85f, 1.0f }, 0, MOTION_SHIFT_X, 0, 1.0f },
+	// Bottom seal, control panel and status lights
+	{ -1, { 0.0f, 0.05f, 0.0f }, { 0.0f }, { 0.42f, 0.1f, 0.08f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.18f, 0.22f, 0.26f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ -1, { -0.3f, 0.25f, 0.18f }, { 0.0f }, { 0.06f, 0.12f, 0.06f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.2f, 0.25f, 0.3f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ -1, { -0.3f, 0.3f, 0.22f }, { 0.0f }, { 0.02f, 0.02f, 0.02f }, PART_SPHERE, 12, 12, 1.0f, 0.0f, { 0.2f, 0.8f, 0.3f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ -1, { -0.3f, 0.27f, 0.22f }, { 0.0f }, { 0.02f, 0.02f, 0.02f }, PART_SPHERE, 12, 12, 1.0f, 0.0f, { 0.9f, 0.3f, 0.2f, 1.0f }, 0, MOTION_NONE, 0, 0.0f }
+};
+
+// Channel 0 is the sway angle; the second branch counter-sways
+const RigPart CORAL_PARTS[] = {
+	{ -1, { 0.0f, 0.08f, 0.0f }, { 0.0f }, { 0.22f, 0.04f, 0.22f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.25f, 0.18f, 0.35f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ -1, { -0.05f, 0.18f, 0.02f }, { 0.0f }, { 0.08f, 0.18f, 0.08f }, PART_SPHERE, 18, 18, 1.0f, 0.0f, { 0.58f, 0.25f, 0.6f, 1.0f }, 0, MOTION_ROTATE_Z, 0, 1.0f },
+	{ -1, { 0.06f, 0.2f, -0.04f }, { 0.0f }, { 0.06f, 0.16f, 0.06f }, PART_SPHERE, 18, 18, 1.0f, 0.0f, { 0.58f, 0.25f, 0.6f, 1.0f }, 0, MOTION_ROTATE_Z, 0, -0.6f },
+	{ -1, { 0.02f, 0.12f, 0.06f }, { 0.0f }, { 0.05f, 0.14f, 0.05f }, PART_SPHERE, 18, 18, 1.0f, 0.0f, { 0.58f, 0.25f, 0.6f, 1.0f }, 0, MOTION_NONE, 0, 0.0f }
+};
+
+// Channel 0 is the screen pulse
+const RigPart CONSOLE_PARTS[] = {
+	{ -1, { 0.0f, 0.0f, 0.0f }, { 0.0f }, { 0.28f, 0.12f, 0.36f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.26f, 0.32f, 0.38f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ -1, { 0.0f, 0.1f, -0.12f }, { 0.0f }, { 0.24f, 0.14f, 0.14f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.26f, 0.32f, 0.38f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ -1, { 0.0f, 0.18f, -0.15f }, { 0.0f }, { 0.28f, 0.02f, 0.14f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.15f, 0.7f, 0.75f, 1.0f }, 0, MOTION_PULSE_XZ, 0, 1.0f },
+	{ -1, { -0.08f, 0.07f, 0.15f }, { 0.0f }, { 0.08f, 0.16f, 0.08f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.3f, 0.5f, 0.6f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ -1, { 0.08f, 0.07f, 0.15f }, { 0.0f }, { 0.08f, 0.16f, 0.08f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.3f, 0.5f, 0.6f, 1.0f }, 0, MOTION_NONE, 0, 0.0f }
+};
+
+// Channel 0 is the body's bob, channel 1 the rotor spin
+const RigPart DRONE_PARTS[] = {
+	{ -1, { 0.0f, 0.16f, 0.0f }, { 0.0f }, { 1.0f, 1.0f, 1.0f }, PART_GROUP, 0, 0, 1.0f, 0.0f, { 0.0f }, 0, MOTION_SHIFT_Y, 0, 1.0f },
+	// Main body and band
+	{ 0, { 0.0f, 0.0f, 0.0f }, { 0.0f }, { 0.16f, 0.08f, 0.16f }, PART_SPHERE, 22, 22, 1.0f, 0.0f, { 0.65f, 0.2f, 0.3f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ 0, { 0.0f, 0.0f, 0.0f }, { 0.0f }, { 1.0f, 1.0f, 1.0f }, PART_TORUS, 12, 20, 0.09f, 0.012f, { 0.5f, 0.15f, 0.25f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	// Rotor arms
+	{ 0, { 0.14f, 0.0f, 0.0f }, { 0.0f }, { 0.12f, 0.04f, 0.04f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.2f, 0.22f, 0.25f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ 0, { -0.14f, 0.0f, 0.0f }, { 0.0f }, { 0.12f, 0.04f, 0.04f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.2f, 0.22f, 0.25f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ 0, { 0.0f, 0.0f, 0.14f }, { 0.0f }, { 0.04f, 0.04f, 0.12f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.2f, 0.22f, 0.25f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ 0, { 0.0f, 0.0f, -0.14f }, { 0.0f }, { 0.04f, 0.04f, 0.12f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.2f, 0.22f, 0.25f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	// Rotor propellers, alternating spin
+	{ 0, { 0.2f, 0.02f, 0.0f }, { 0.0f }, { 0.08f, 0.01f, 0.08f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.3f, 0.35f, 0.4f, 1.0f }, 0, MOTION_ROTATE_Y, 1, 1.0f },
+	{ 0, { -0.2f, 0.02f, 0.0f }, { 0.0f }, { 0.08f, 0.01f, 0.08f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.3f, 0.35f, 0.4f, 1.0f }, 0, MOTION_ROTATE_Y, 1, -1.0f },
+	{ 0, { 0.0f, 0.02f, 0.2f }, { 0.0f }, { 0.08f, 0.01f, 0.08f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.3f, 0.35f, 0.4f, 1.0f }, 0, MOTION_ROTATE_Y, 1, 1.0f },
+	{ 0, { 0.0f, 0.02f, -0.2f }, { 0.0f }, { 0.08f, 0.01f, 0.08f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.3f, 0.35f, 0.4f, 1.0f }, 0, MOTION_ROTATE_Y, 1, -1.0f },
+	// Sensor dome, front sensor, antenna mast and tip, bottom light
+	{ 0, { 0.0f, 0.05f, 0.0f }, { 0.0f }, { 0.08f, 0.02f, 0.08f }, PART_SPHERE, 18, 18, 1.0f, 0.0f, { 0.9f, 0.5f, 0.6f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ 0, { 0.0f, 0.0f, 0.09f }, { 0.0f }, { 0.04f, 0.04f, 0.04f }, PART_SPHERE, 16, 16, 1.0f, 0.0f, { 0.15f, 0.7f, 0.8f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ 0, { 0.0f, 0.08f, 0.0f }, { 0.0f }, { 0.015f, 0.06f, 0.015f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.25f, 0.28f, 0.32f, 1.0f }, PART_DETAIL, MOTION_NONE, 0, 0.0f },
+	{ 0, { 0.0f, 0.12f, 0.0f }, { 0.0f }, { 0.02f, 0.02f, 0.02f }, PART_SPHERE, 12, 12, 1.0f, 0.0f, { 0.9f, 0.7f, 0.2f, 1.0f }, PART_DETAIL, MOTION_NONE, 0, 0.0f },
+	{ 0, { 0.0f, -0.05f, 0.0f }, { 0.0f }, { 0.025f, 0.015f, 0.025f }, PART_SPHERE, 14, 14, 1.0f, 0.0f, { 0.9f, 0.95f, 0.3f, 1.0f }, 0, MOTION_NONE, 0, 0.0f }
+};
+
+// The diver: channel 0 is the yaw, channel 1 the tilt
+const RigPart PLAYER_PARTS[] = {
+	{ -1, { 0.0f, 0.0f, 0.0f }, { 0.0f }, { 1.0f, 1.0f, 1.0f }, PART_GROUP, 0, 0, 1.0f, 0.0f, { 0.0f }, 0, MOTION_ROTATE_Y, 0, 1.0f },
+	{ 0, { 0.0f, 0.0f, 0.0f }, { 0.0f }, { 1.0f, 1.0f, 1.0f }, PART_GROUP, 0, 0, 1.0f, 0.0f, { 0.0f }, 0, MOTION_ROTATE_X, 1, 1.0f },
+	// Torso and equipment harness
+	{ 1, { 0.0f, 0.13f, 0.0f }, { 0.0f }, { 0.1f, 0.18f, 0.07f }, PART_SPHERE, 20, 20, 1.0f, 0.0f, { 0.12f, 0.3f, 0.5f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ 1, { 0.0f, 0.15f, 0.055f }, { 0.0f }, { 0.08f, 0.14f, 0.02f }, PART_CUBE, 1, 1, 1.0f, 0.0f, { 0.15f, 0.15f, 0.18f, 1.0f }, PART_DETAIL, MOTION_NONE, 0, 0.0f },
+	// Legs, upper arms and forearms
+	{ 1, { -0.035f, 0.05f, 0.0f }, { -5.0f, 0.0f, 0.0f, 1.0f }, { 0.03f, 0.1f, 0.03f }, PART_SPHERE, 16, 16, 1.0f, 0.0f, { 0.1f, 0.25f, 0.42f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ 1, { 0.035f, 0.05f, 0.0f }, { 5.0f, 0.0f, 0.0f, 1.0f }, { 0.03f, 0.1f, 0.03f }, PART_SPHERE, 16, 16, 1.0f, 0.0f, { 0.1f, 0.25f, 0.42f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ 1, { -0.08f, 0.18f, 0.0f }, { -15.0f, 0.0f, 0.0f, 1.0f }, { 0.025f, 0.08f, 0.025f }, PART_SPHERE, 16, 16, 1.0f, 0.0f, { 0.1f, 0.25f, 0.42f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ 1, { 0.08f, 0.18f, 0.0f }, { 15.0f, 0.0f, 0.0f, 1.0f }, { 0.025f, 0.08f, 0.025f }, PART_SPHERE, 16, 16, 1.0f, 0.0f, { 0.1f, 0.25f, 0.42f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ 1, { -0.09f, 0.1f, 0.0f }, { -10.0f, 0.0f, 0.0f, 1.0f }, { 0.022f, 0.07f, 0.022f }, PART_SPHERE, 14, 14, 1.0f, 0.0f, { 0.1f, 0.25f, 0.42f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ 1, { 0.09f, 0.1f, 0.0f }, { 10.0f, 0.0f, 0.0f, 1.0f }, { 0.022f, 0.07f, 0.022f }, PART_SPHERE, 14, 14, 1.0f, 0.0f, { 0.1f, 0.25f, 0.42f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	// Helmet dome, ring collar and air tank
+	{ 1, { 0.0f, 0.28f, 0.01f }, { 0.0f }, { 1.0f, 1.0f, 1.0f }, PART_SPHERE, 24, 24, 0.065f, 0.0f, { 0.55f, 0.75f, 0.85f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ 1, { 0.0f, 0.23f, 0.0f }, { 0.0f }, { 1.0f, 1.0f, 1.0f }, PART_TORUS, 12, 20, 0.07f, 0.015f, { 0.3f, 0.32f, 0.35f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	{ 1, { 0.0f, 0.16f, -0.06f }, { 0.0f }, { 0.06f, 0.12f, 0.04f }, PART_SPHERE, 16, 16, 1.0f, 0.0f, { 0.25f, 0.27f, 0.3f, 1.0f }, 0, MOTION_NONE, 0, 0.0f },
+	// Face behind the visor
+	{ 1, { 0.0f, 0.28f, 0.035f }, { 0.0f }, { 0.04f, 0.05f, 0.03f }, PART_SPHERE, 12, 12, 1.0f, 0.0f, { 0.15f, 0.12f, 0.1f, 0.6f }, PART_UNLIT, MOTION_NONE, 0, 0.0f }
+};
+
+// The goal pickup: channel 0 is the spin, channel 1 the core's pulse. The
+// colored body mesh ignores the part color.
+const RigPart GOAL_PARTS[] = {
+	{ -1, { 0.0f, 0.0f, 0.0f }, { 0.0f }, { 1.0f, 1.0f, 1.0f }, PART_GROUP, 0, 0, 1.0f, 0.0f, { 0.0f }, 0, MOTION_ROTATE_Y, 0, 1.0f },
+	{ 0, { 0.0f, 0.0f, 0.0f }, { 0.0f }, { 1.0f, 1.0f, 1.0f }, PART_GOAL_BODY, 0, 0, 1.0f, 0.0f, { 1.0f, 1.0f, 1.0f, 1.0f }, PART_BODY, MOTION_NONE, 0, 0.0f },
+	{ 0, { 0.0f, 0.0f, 0.0f }, { 0.0f }, { 1.0f, 1.0f, 1.0f }, PART_SPHERE, 24, 24, 0.045f, 0.0f, { 0.2f, 0.7f, 0.95f, 0.8f }, PART_UNLIT, MOTION_PULSE, 1, 1.0f },
+	{ 0, { 0.0f, 0.0f, 0.0f }, { 0.0f }, { 1.0f, 1.0f, 1.0f }, PART_SPHERE, 20, 20, 0.055f, 0.0f, { 0.4f, 0.85f, 1.0f, 0.5f }, PART_UNLIT, MOTION_PULSE, 1, 1.2f }
+};
+
+Rig propRigs[MODEL_COUNT];
+Rig playerRig;
+Rig goalRig;
+RigPose playerPose;
+RigPose goalPose;            // shared by every goal; posed before the draw jobs
+std::vector<RigPose> propPoses; // one per prop; each draw job poses only its own
+
+void floodlightChannels(float phase, float channels[RIG_MAX_CHANNELS]) {
+	channels[0] = phase * 60.0f;
+}
+
+void airlockChannels(float phase, float channels[RIG_MAX_CHANNELS]) {
+	channels[0] = 0.16f * (0.5f + 0.5f * sinf(phase));
+}
+
+void coralChannels(float phase, float channels[RIG_MAX_CHANNELS]) {
+	channels[0] = 8.0f * sinf(phase);
+}
+
+void consoleChannels(float phase, float channels[RIG_MAX_CHANNELS]) {
+	channels[0] = 1.0f + 0.1f * sinf(phase);
+}
+
+void droneChannels(float phase, float channels[RIG_MAX_CHANNELS]) {
+	channels[0] = 0.07f * sinf(phase);
+	channels[1] = phase * 8.0f;
+}
+
+typedef void (*RigChannelFunction)(float phase, float channels[RIG_MAX_CHANNELS]);
+
+// Turns a prop's animation phase into its model's channels
+const RigChannelFunction PROP_CHANNELS[MODEL_COUNT] = {
+	floodlightChannels, airlockChannels, coralChannels, consoleChannels, droneChannels
+};
+
+// Builds a part's frame from its parent's, and the matrix its mesh is drawn
+// with. `channels` is NULL for static parts.
+void posePart(const RigPart &part, const float parent[16], const float *channels, float frame[16], float model[16]) {
+	float value = channels ? channels[part.channel] : 0.0f;
+	float x = part.translate[0];
+	float y = part.translate[1];
+	float z = part.translate[2];
+	float sx = part.scale[0];
+	float sz = part.scale[2];
+	float size = part.size;
+	switch (part.motion) {
+	case MOTION_SHIFT_X:
+		x += value * part.gain;
+		break;
+	case MOTION_SHIFT_Y:
+		y += value * part.gain;
+		break;
+	case MOTION_PULSE_XZ:
+		sx *= value * part.gain;
+		sz *= value * part.gain;
+		break;
+	case MOTION_PULSE:
+		size = size * value * part.gain;
+		break;
+	default:
+		break;
+	}
+	memcpy(frame, parent, 16 * sizeof(float));
+	applyTranslation(frame, x, y, z);
+	if (part.motion == MOTION_ROTATE_X || part.motion == MOTION_ROTATE_Y || part.motion == MOTION_ROTATE_Z) {
+		applyRotation(frame, value * part.gain, part.motion == MOTION_ROTATE_X, part.motion == MOTION_ROTATE_Y, part.motion == MOTION_ROTATE_Z);
+	}
+	if (part.rotate[0] != 0.0f) {
+		applyRotation(frame, part.rotate[0], part.rotate[1], part.rotate[2], part.rotate[3]);
+	}
+	memcpy(model, frame, 16 * sizeof(float));
+	applyScale(model, sx, part.scale[1], sz);
+	if (size != 1.0f) {
+		applyScale(model, size, size, size);
+	}
+}
+
+const Mesh *partMesh(const RigPart &part) {
+	switch (part.mesh) {
+	case PART_CUBE:
+		return &primitiveMesh(SHAPE_CUBE, 1, 1, 0);
+	case PART_SPHERE:
+		return &sphereMesh(part.slices, part.stacks);
+	case PART_TORUS:
+		return &torusMesh(part.inner, part.size, part.slices, part.stacks);
+	case PART_GOAL_BODY:
+		return &goalBodyMesh;
+	default:
+		return NULL;
+	}
+}
+
+bool shiftMotion(PartMotion motion) {
+	return motion == MOTION_SHIFT_X || motion == MOTION_SHIFT_Y;
+}
+
+// Marks the animated parts, builds the static ones (a static shift at zero)
+// and looks up every part's mesh at each detail level
+void initRig(Rig &rig, const char *name, const RigPart *parts, int partCount) {
+	float identity[16];
+	identityMatrix(identity);
+	rig.name = name;
+	rig.parts = parts;
+	rig.partCount = std::min(partCount, RIG_MAX_PARTS);
+	rig.slotCount = 0;
+	for (int p = 0; p < rig.partCount; ++p) {
+		const RigPart &part = parts[p];
+		bool parentAnimated = part.parent >= 0 && rig.animated[part.parent];
+		rig.animated[p] = parentAnimated || (part.motion != MOTION_NONE && !(shiftMotion(part.motion) && !parentAnimated));
+		rig.slot[p] = rig.animated[p] && part.mesh != PART_GROUP ? rig.slotCount++ : -1;
+		const float *parent = part.parent >= 0 ? rig.frames[part.parent] : identity;
+		if (!rig.animated[p]) {
+			posePart(part, parent, NULL, rig.frames[p], rig.models[p]);
+			int column = part.motion == MOTION_SHIFT_X ? 0 : 4;
+			for (int r = 0; r < 3; ++r) {
+				rig.shiftAxis[p][r] = shiftMotion(part.motion) ? parent[column + r] : 0.0f;
+			}
+		}
+		for (int level = LOD_FULL; level <= LOD_COARSE; ++level) {
+			lodLevel = (LodLevel)level;
+			rig.meshes[p][level] = partMesh(part);
+		}
+	}
+	lodLevel = LOD_FULL;
+}
+
+void initRigs() {
+	initRig(propRigs[MODEL_FLOODLIGHT], "drawFloodlight", FLOODLIGHT_PARTS, sizeof(FLOODLIGHT_PARTS) / sizeof(FLOODLIGHT_PARTS[0]));
+	initRig(propRigs[MODEL_AIRLOCK], "drawAirlock", AIRLOCK_PARTS, sizeof(AIRLOCK_PARTS) / sizeof(AIRLOCK_PARTS[0]));
+	initRig(propRigs[MODEL_CORAL], "drawCoralCluster", CORAL_PARTS, sizeof(CORAL_PARTS) / sizeof(CORAL_PARTS[0]));
+	initRig(propRigs[MODEL_CONSOLE], "drawConsole", CONSOLE_PARTS, sizeof(CONSOLE_PARTS) / sizeof(CONSOLE_PARTS[0]));
+	initRig(propRigs[MODEL_DRONE], "drawDrone", DRONE_PARTS, sizeof(DRONE_PARTS) / sizeof(DRONE_PARTS[0]));
+	initRig(playerRig, "drawPlayer", PLAYER_PARTS, sizeof(PLAYER_PARTS) / sizeof(PLAYER_PARTS[0]));
+	initRig(goalRig, "drawGoalAt", GOAL_PARTS, sizeof(GOAL_PARTS) / sizeof(GOAL_PARTS[0]));
+}
+
+// Rebuilds the animated parts of one instance, parents first, unless the pose
+// already holds these channels
+void poseRig(const Rig &rig, const float channels[RIG_MAX_CHANNELS], RigPose &pose) {
+	if (pose.rig == &rig && memcmp(pose.channels, channels, sizeof(pose.channels)) == 0) {
+		return;
+	}
+	pose.rig = &rig;
+	memcpy(pose.channels, channels, sizeof(pose.channels));
+	if (rig.slotCount == 0) {
+		return;
+	}
+	float identity[16];
+	identityMatrix(identity);
+	float frames[RIG_MAX_PARTS][16];
+	float model[16];
+	for (int p = 0; p < rig.partCount; ++p) {
+		if (!rig.animated[p]) {
+			continue;
+		}
+		const RigPart &part = rig.parts[p];
+		const float *parent = part.parent < 0 ? identity : rig.animated[part.parent] ? frames[part.parent] : rig.frames[part.parent];
+		posePart(part, parent, channels, frames[p], rig.slot[p] >= 0 ? pose.models[rig.slot[p]] : model);
+		++frameCounters.transforms;
+	}
+}
+
+// Queues the parts of a posed instance with its root at (x, y, z), at the
+// current LOD level
+void drawRig(const Rig &rig, const RigPose &pose, float x, float y, float z) {
+	TraceScope trace(rig.name);
+	int level = lodLevel < LOD_COARSE ? lodLevel : LOD_COARSE;
+	float offsets[RIG_MAX_PARTS][3]; // the instance position plus static shifts above the part
+	for (int p = 0; p < rig.partCount; ++p) {
+		const RigPart &part = rig.parts[p];
+		float *offset = offsets[p];
+		if (part.parent >= 0) {
+			memcpy(offset, offsets[part.parent], sizeof(offsets[p]));
+		} else {
+			offset[0] = x;
+			offset[1] = y;
+			offset[2] = z;
+		}
+		if (shiftMotion(part.motion) && !rig.animated[p]) {
+			float shift = pose.channels[part.channel] * part.gain;
+			for (int r = 0; r < 3; ++r) {
+				offset[r] += rig.shiftAxis[p][r] * shift;
+			}
+		}
+		if (part.mesh == PART_GROUP || ((part.flags & PART_DETAIL) && !lodDetail()) || ((part.flags & PART_BODY) && lodLevel == LOD_IMPOSTOR)) {
+			continue;
+		}
+		renderQueue.packets.push_back(RenderPacket());
+		RenderPacket &packet = renderQueue.packets.back();
+		packet.mesh = rig.meshes[p][level];
+		memcpy(packet.model, rig.animated[p] ? pose.models[rig.slot[p]] : rig.models[p], sizeof(packet.model));
+		packet.model[12] += offset[0];
+		packet.model[13] += offset[1];
+		packet.model[14] += offset[2];
+		memcpy(packet.color, part.color, sizeof(packet.color));
+		packet.lighting = !(part.flags & PART_UNLIT);
+		packet.key = renderKey(packet);
+	}
+}
+
+// The seabed never changes, so tiles and grid lines are baked once into a
+// single buffer: the tiles as indexed triangles, the lines appended after them.
+// The floor tiles are grouped into square chunks so drawGround can skip the
+// ones outside the view; each chunk is a contiguous run of indices.
+const int GROUND_CHUNK_TILES = 5;
+const int GROUND_CHUNKS = GROUND_GRID_SIZE / GROUND_CHUNK_TILES;
+
+struct GroundChunk {
+	GLsizei indexFirst;
+	GLsizei indexCount;
+	float minCorner[3], maxCorner[3];
+};
+
+struct GroundMesh {
+	Mesh mesh;
+	GroundChunk chunks[GROUND_CHUNKS * GROUND_CHUNKS];
+	GLint lineFirst;
+	GLsizei lineCount;
+};
+
+GroundMesh groundMesh;
+
+void initGroundMesh() {
+	MeshBuilder b;
+	float baseY = GROUND_Y - 0.01f;
+	float extent = scene.half * 1.1f;
+	float tileSize = (extent * 2.0f) / GROUND_GRID_SIZE;
+	float half = tileSize * 0.48f;
+	for (int ci = 0; ci < GROUND_CHUNKS; ++ci) {
+		for (int cj = 0; cj < GROUND_CHUNKS; ++cj) {
+			GroundChunk &chunk = groundMesh.chunks[ci * GROUND_CHUNKS + cj];
+			chunk.indexFirst = (GLsizei)b.indices.size();
+			for (int i = ci * GROUND_CHUNK_TILES; i < (ci + 1) * GROUND_CHUNK_TILES; ++i) {
+				for (int j = cj * GROUND_CHUNK_TILES; j < (cj + 1) * GROUND_CHUNK_TILES; ++j) {
+					float cx = -extent + i * tileSize + tileSize * 0.5f;
+					float cz = -extent + j * tileSize + tileSize * 0.5f;
+					float y = baseY + sinf(i * 0.5f) * cosf(j * 0.4f) * 0.005f;
+
+					// Varying tile colors for depth
+					float colorVar = 0.9f + 0.1f * sinf((i + j) * 0.3f);
+					b.setColor(0.06f * colorVar, 0.14f * colorVar, 0.18f * colorVar);
+					GLuint a = b.addVertex(cx - half, y, cz - half, 0.0f, 1.0f, 0.0f);
+					b.addVertex(cx + half, y, cz - half, 0.0f, 1.0f, 0.0f);
+					b.addVertex(cx + half, y, cz + half, 0.0f, 1.0f, 0.0f);
+					b.addVertex(cx - half, y, cz + half, 0.0f, 1.0f, 0.0f);
+					b.addQuad(a, a + 3, a + 2, a + 1);
+				}
+			}
+			chunk.indexCount = (GLsizei)b.indices.size() - chunk.indexFirst;
+			float chunkSize = tileSize * GROUND_CHUNK_TILES;
+			chunk.minCorner[0] = -extent + ci * chunkSize;
+			chunk.minCorner[1] = baseY - 0.005f;
+			chunk.minCorner[2] = -extent + cj * chunkSize;
+			chunk.maxCorner[0] = chunk.minCorner[0] + chunkSize;
+			chunk.maxCorner[1] = baseY + 0.005f;
+			chunk.maxCorner[2] = chunk.minCorner[2] + chunkSize;
+		}
+	}
+	
+	// Grid lines for detail
+	groundMesh.lineFirst = (GLint)(b.vertices.size() / 6);
+	b.setColor(0.12f, 0.25f, 0.3f);
+	float lineY = baseY + 0.002f;
+	for (int i = 0; i <= GROUND_GRID_SIZE; ++i) {
+		float pos = -extent + i * tileSize;
+		b.addVertex(pos, lineY, -extent, 0.0f, 1.0f, 0.0f);
+		b.addVertex(pos, lineY, extent, 0.0f, 1.0f, 0.0f);
+		b.addVertex(-extent, lineY, pos, 0.0f, 1.0f, 0.0f);
+		b.addVertex(extent, lineY, pos, 0.0f, 1.0f, 0.0f);
+	}
+	groundMesh.lineCount = (GLsizei)(b.vertices.size() / 6) - groundMesh.lineFirst;
+	groundMesh.mesh = b.upload();
+	boundMesh = NULL;
+}
+
+void drawGround() {
+	TraceScope trace("drawGround");
+	// Visible chunks next to each other in the index buffer go out as one draw
+	bindMesh(groundMesh.mesh);
+	const int chunkCount = GROUND_CHUNKS * GROUND_CHUNKS;
+	int runStart = -1;
+	for (int c = 0; c <= chunkCount; ++c) {
+		bool visible = c < chunkCount && boxVisible(groundMesh.chunks[c].minCorner, groundMesh.chunks[c].maxCorner);
+		if (visible && runStart < 0) {
+			runStart = c;
+		} else if (!visible && runStart >= 0) {
+			GLsizei first = groundMesh.chunks[runStart].indexFirst;
+			GLsizei count = groundMesh.chunks[c - 1].indexFirst + groundMesh.chunks[c - 1].indexCount - first;
+			glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT, (const GLvoid *)(first * sizeof(GLuint)));
+			countDraw(count);
+			runStart = -1;
+		}
+	}
+	disableCap(GL_LIGHTING);
+	setLineWidth(1.0f);
+	glDrawArrays(GL_LINES, groundMesh.lineFirst, groundMesh.lineCount);
+	countDraw(groundMesh.lineCount);
+	enableCap(GL_LIGHTING);
+}
+
+// `wall` is the wall's world transform; each plate, frame and rivet composes
+// its own offset onto it and is loaded with loadModelMatrix
+void drawWallPanel(const float wall[16], float width, float height, float colorPhase, int rivetSlices) {
+	TraceScope trace("drawWallPanel");
+	const Mesh &cube = primitiveMesh(SHAPE_CUBE, 1, 1, 0);
+	float model[16];
+	float r = 0.18f + 0.12f * sinf(colorPhase);
+	float g = 0.38f + 0.18f * sinf(colorPhase + 2.094f);
+	float b = 0.52f + 0.18f * sinf(colorPhase + 4.188f);
+	
+	int panels = WALL_PANEL_COLUMNS;
+	float panelWidth = width / panels;
+	float panelHeight = height / WALL_PANEL_ROWS;
+	
+	for (int row = 0; row < WALL_PANEL_ROWS; ++row) {
+		for (int col = 0; col < panels; ++col) {
+			float px = -width * 0.5f + col * panelWidth + panelWidth * 0.5f;
 			float py = row * panelHeight + panelHeight * 0.5f;
 			
 			// Panel plate with slight color variation
 			float variation = 0.95f + 0.05f * sinf((row + col) * 1.2f);
-			glColor3f(r * variation, g * variation, b * variation);
-			glPushMatrix();
-			glTranslatef(px, py, 0.015f);
-			glScalef(panelWidth * 0.92f, panelHeight * 0.9f, 0.025f);
-			glutSolidCube(1.0f);
-			glPopMatrix();
+			setDrawColor(r * variation, g * variation, b * variation);
+			memcpy(model, wall, sizeof(model));
+			applyTranslation(model, px, py, 0.015f);
+			applyScale(model, panelWidth * 0.92f, panelHeight * 0.9f, 0.025f);
+			loadModelMatrix(model);
+			drawMesh(cube);
 			
 			// Panel frame
-			glColor3f(r * 0.6f, g * 0.6f, b * 0.6f);
-			glPushMatrix();
-			glTranslatef(px, py, 0.005f);
-			glScalef(panelWidth * 0.96f, panelHeight * 0.94f, 0.015f);
-			glutSolidCube(1.0f);
-			glPopMatrix();
+			setDrawColor(r * 0.6f, g * 0.6f, b * 0.6f);
+			memcpy(model, wall, sizeof(model));
+			applyTranslation(model, px, py, 0.005f);
+			applyScale(model, panelWidth * 0.96f, panelHeight * 0.94f, 0.015f);
+			loadModelMatrix(model);
+			drawMesh(cube);
 			
 			// Rivets at corners
-			glColor3f(0.4f, 0.45f, 0.5f);
+			setDrawColor(0.4f, 0.45f, 0.5f);
 			float rivetPos[4][2] = {
 				{-panelWidth * 0.42f, -panelHeight * 0.4f},
 				{panelWidth * 0.42f, -panelHeight * 0.4f},
 				{-panelWidth * 0.42f, panelHeight * 0.4f},
 				{panelWidth * 0.42f, panelHeight * 0.4f}
 			};
-			for (int i = 0; i < 4; ++i) {
-				glPushMatrix();
-				glTranslatef(px + rivetPos[i][0], py + rivetPos[i][1], 0.025f);
-				glutSolidSphere(0.008f, 8, 8);
-				glPopMatrix();
+			for (int i = 0; i < 4 && rivetSlices > 0; ++i) {
+				memcpy(model, wall, sizeof(model));
+				applyTranslation(model, px + rivetPos[i][0], py + rivetPos[i][1], 0.025f);
+				applyScale(model, WALL_RIVET_RADIUS, WALL_RIVET_RADIUS, WALL_RIVET_RADIUS);
+				loadModelMatrix(model);
+				drawMesh(primitiveMesh(SHAPE_SPHERE, rivetSlices, rivetSlices, 0));
+			}
+		}
+	}
+}
+
+// Placement of the four walls: unit offset from the center, yaw, color phase offset
+struct WallPlacement {
+	float x, z;
+	float yaw;
+	float phaseOffset;
+};
+
+const WallPlacement WALLS[4] = {
+	{ 0.0f, -1.0f, 0.0f, 0.0f },   // Back wall (-Z)
+	{ 0.0f, 1.0f, 180.0f, 1.5f },  // Front wall (+Z)
+	{ -1.0f, 0.0f, 90.0f, 3.0f },  // Left wall (-X)
+	{ 1.0f, 0.0f, -90.0f, 4.5f }   // Right wall (+X)
+};
+
+const float WALL_HEIGHT = 0.7f;
+
+// World-space bounds of a wall's panels, frames and rivets
+void wallBounds(const WallPlacement &wall, float minCorner[3], float maxCorner[3]) {
+	const float depth = 0.05f;
+	float c = fabsf(cosf(DEG2RAD(wall.yaw)));
+	float s = fabsf(sinf(DEG2RAD(wall.yaw)));
+	float extentX = c * scene.half + s * depth;
+	float extentZ = s * scene.half + c * depth;
+	minCorner[0] = wall.x * scene.half - extentX;
+	maxCorner[0] = wall.x * scene.half + extentX;
+	minCorner[1] = WALL_HEIGHT * 0.5f - depth;
+	maxCorner[1] = WALL_HEIGHT * 1.5f + depth;
+	minCorner[2] = wall.z * scene.half - extentZ;
+	maxCorner[2] = wall.z * scene.half + extentZ;
+}
+
+bool wallVisible(int w) {
+	float minCorner[3], maxCorner[3];
+	wallBounds(WALLS[w], minCorner, maxCorner);
+	return boxVisible(minCorner, maxCorner);
+}
+
+// Rivets are a few pixels across at most, so their detail follows the distance
+// to the nearest point of the wall: full spheres up close, coarse ones further
+// out, none once they shrink below a pixel
+int wallRivetSlices(int w) {
+	if (!lodEnabled) {
+		return WALL_RIVET_SLICES;
+	}
+	float minCorner[3], maxCorner[3];
+	wallBounds(WALLS[w], minCorner, maxCorner);
+	const float eye[3] = { camera.eye.x, camera.eye.y, camera.eye.z };
+	float distanceSquared = 0.0f;
+	for (int i = 0; i < 3; ++i) {
+		float d = std::max(minCorner[i] - eye[i], std::max(0.0f, eye[i] - maxCorner[i]));
+		distanceSquared += d * d;
+	}
+	float pixels = projectedPixels(WALL_RIVET_RADIUS, sqrtf(distanceSquared));
+	if (pixels >= WALL_RIVET_FULL_PIXELS) {
+		return WALL_RIVET_SLICES;
+	}
+	return pixels >= WALL_RIVET_MIN_PIXELS ? WALL_RIVET_SLICES_FAR : 0;
+}
+
+// Instanced wall rendering: every plate, frame and rivet is one instance with
+// a fixed transform, and the color cycling runs in the vertex shader.
+struct WallInstancing {
+	GLuint program;
+	GLint colorPhaseLocation;
+	GLint lightCountLocation;
+	GLint lightCount; // value last uploaded to lightCountLocation, -1 before the first
+	GLuint instanceBuffer;
+	GLsizei cubeInstances;  // plates and frames, stored first
+	GLsizei rivetInstances; // rivets, stored after the cubes
+};
+
+WallInstancing wallInstancing = { 0, -1, -1, -1, 0, 0, 0 };
+
+const GLuint WALL_ATTRIB_MODEL = 4;  // first model-matrix column
+const GLuint WALL_MODEL_COLUMNS = 4; // one attribute per column, locations 4-7
+const GLuint WALL_ATTRIB_TINT = 8;   // color phase, shade, rivet flag
+const int WALL_TINT_OFFSET = 16;     // floats ahead of the tint in an instance
+const int WALL_INSTANCE_FLOATS = 20;
+
+// Per-vertex lighting equivalent to the fixed-function path with
+// GL_COLOR_MATERIAL; fog is still applied by the fixed-function fragment stage.
+const char *WALL_VERTEX_SHADER =
+	"#version 120\n"
+	"attribute mat4 instanceModel;\n"
+	"attribute vec4 instanceTint; // phase offset, shade, rivet mix\n"
+	"uniform float colorPhase;\n"
+	"uniform int lightCount;\n"
+	"void main() {\n"
+	"	vec4 eye = gl_ModelViewMatrix * (instanceModel * gl_Vertex);\n"
+	"	vec3 n = normalize(gl_NormalMatrix * (mat3(instanceModel) * gl_Normal));\n"
+	"	float p = colorPhase + instanceTint.x;\n"
+	"	vec3 panel = vec3(0.18 + 0.12 * sin(p), 0.38 + 0.18 * sin(p + 2.094), 0.52 + 0.18 * sin(p + 4.188));\n"
+	"	vec3 color = mix(panel * instanceTint.y, vec3(0.4, 0.45, 0.5), instanceTint.z);\n"
+	"	vec3 lit = gl_FrontMaterial.emission.rgb + color * gl_LightModel.ambient.rgb;\n"
+	"	for (int i = 0; i < lightCount; ++i) {\n"
+	"		vec4 position = gl_LightSource[i].position;\n"
+	"		vec3 toLight = position.xyz - eye.xyz * position.w;\n"
+	"		float d = length(toLight);\n"
+	"		vec3 l = toLight / d;\n"
+	"		float att = position.w == 0.0 ? 1.0 : 1.0 / (gl_LightSource[i].constantAttenuation + gl_LightSource[i].linearAttenuation * d + gl_LightSource[i].quadraticAttenuation * d * d);\n"
+	"		float nDotL = max(dot(n, l), 0.0);\n"
+	"		vec3 term = color * gl_LightSource[i].ambient.rgb + color * gl_LightSource[i].diffuse.rgb * nDotL;\n"
+	"		if (nDotL > 0.0) {\n"
+	"			float nDotH = max(dot(n, normalize(l + vec3(0.0, 0.0, 1.0))), 0.0);\n"
+	"			term += gl_FrontMaterial.specular.rgb * gl_LightSource[i].specular.rgb * pow(nDotH, gl_FrontMaterial.shininess);\n"
+	"		}\n"
+	"		lit += att * term;\n"
+	"	}\n"
+	"	gl_FrontColor = vec4(lit, 1.0);\n"
+	"	gl_FogFragCoord = abs(eye.z);\n"
+	"	gl_Position = gl_ProjectionMatrix * eye;\n"
+	"}\n";
+
+// Column-major T(wall) * Ry(yaw) * T(offset) * S(scale)
+void appendWallInstance(std::vector<GLfloat> &out, const WallPlacement &wall, float px, float py, float pz, float sx, float sy, float sz, float phase, float shade, float rivet) {
+	float c = cosf(DEG2RAD(wall.yaw));
+	float s = sinf(DEG2RAD(wall.yaw));
+	GLfloat instance[WALL_INSTANCE_FLOATS] = {
+		c * sx, 0.0f, -s * sx, 0.0f,
+		0.0f, sy, 0.0f, 0.0f,
+		s * sz, 0.0f, c * sz, 0.0f,
+		wall.x * scene.half + c * px + s * pz, WALL_HEIGHT * 0.5f + py, wall.z * scene.half - s * px + c * pz, 1.0f,
+		phase, shade, rivet, 0.0f
+	};
+	out.insert(out.end(), instance, instance + WALL_INSTANCE_FLOATS);
+}
+
+void initWallInstancing() {
+	if (!hasExtension("GL_ARB_instanced_arrays") || !hasExtension("GL_ARB_draw_instanced")) {
+		return;
+	}
+	GLuint shader = compileShader(GL_VERTEX_SHADER, WALL_VERTEX_SHADER);
+	if (!shader) {
+		return;
+	}
+	GLuint program = glCreateProgram();
+	glAttachShader(program, shader);
+	glBindAttribLocation(program, WALL_ATTRIB_MODEL, "instanceModel");
+	glBindAttribLocation(program, WALL_ATTRIB_TINT, "instanceTint");
+	bool linked = linkProgram(program);
+	glDeleteShader(shader);
+	if (!linked) {
+		glDeleteProgram(program);
+		return;
+	}
+
+	float width = scene.half * 2.0f;
+	float panelWidth = width / WALL_PANEL_COLUMNS;
+	float panelHeight = WALL_HEIGHT / WALL_PANEL_ROWS;
+	std::vector<GLfloat> cubes;
+	std::vector<GLfloat> rivets;
+	for (int w = 0; w < 4; ++w) {
+		const WallPlacement &wall = WALLS[w];
+		for (int row = 0; row < WALL_PANEL_ROWS; ++row) {
+			for (int col = 0; col < WALL_PANEL_COLUMNS; ++col) {
+				float px = -width * 0.5f + col * panelWidth + panelWidth * 0.5f;
+				float py = row * panelHeight + panelHeight * 0.5f;
+				float variation = 0.95f + 0.05f * sinf((row + col) * 1.2f);
+				appendWallInstance(cubes, wall, px, py, 0.015f, panelWidth * 0.92f, panelHeight * 0.9f, 0.025f, wall.phaseOffset, variation, 0.0f);
+				appendWallInstance(cubes, wall, px, py, 0.005f, panelWidth * 0.96f, panelHeight * 0.94f, 0.015f, wall.phaseOffset, 0.6f, 0.0f);
+				for (int i = 0; i < 4; ++i) {
+					float rx = (i % 2 == 0 ? -0.42f : 0.42f) * panelWidth;
+					float ry = (i < 2 ? -0.4f : 0.4f) * panelHeight;
+					appendWallInstance(rivets, wall, px + rx, py + ry, 0.025f, 0.008f, 0.008f, 0.008f, 0.0f, 0.0f, 1.0f);
+				}
 			}
 		}
 	}
+	wallInstancing.cubeInstances = (GLsizei)(cubes.size() / WALL_INSTANCE_FLOATS);
+	wallInstancing.rivetInstances = (GLsizei)(rivets.size() / WALL_INSTANCE_FLOATS);
+	cubes.insert(cubes.end(), rivets.begin(), rivets.end());
+	glGenBuffers(1, &wallInstancing.instanceBuffer);
+	bindArrayBuffer(wallInstancing.instanceBuffer);
+	glBufferData(GL_ARRAY_BUFFER, cubes.size() * sizeof(GLfloat), cubes.data(), GL_STATIC_DRAW);
+	boundMesh = NULL;
+	wallInstancing.program = program;
+	wallInstancing.colorPhaseLocation = glGetUniformLocation(program, "colorPhase");
+	wallInstancing.lightCountLocation = glGetUniformLocation(program, "lightCount");
+}
+
+void bindWallInstances(GLsizei firstInstance) {
+	GLsizei stride = WALL_INSTANCE_FLOATS * sizeof(GLfloat);
+	size_t base = firstInstance * stride;
+	bindArrayBuffer(wallInstancing.instanceBuffer);
+	for (GLuint c = 0; c < WALL_MODEL_COLUMNS; ++c) {
+		glVertexAttribPointer(WALL_ATTRIB_MODEL + c, 4, GL_FLOAT, GL_FALSE, stride, (const GLvoid *)(base + c * 4 * sizeof(GLfloat)));
+	}
+	glVertexAttribPointer(WALL_ATTRIB_TINT, 4, GL_FLOAT, GL_FALSE, stride, (const GLvoid *)(base + WALL_TINT_OFFSET * sizeof(GLfloat)));
+	boundMesh = NULL;
+}
+
+void drawWallsInstanced() {
+	TraceScope trace("drawWallsInstanced");
+	useProgram(wallInstancing.program);
+	glUniform1f(wallInstancing.colorPhaseLocation, renderState.wallColorPhase);
+	if (updateCached(wallInstancing.lightCount, (GLint)scene.lightCount)) {
+		glUniform1i(wallInstancing.lightCountLocation, (GLint)scene.lightCount);
+	}
+	for (GLuint c = 0; c < WALL_MODEL_COLUMNS; ++c) {
+		glEnableVertexAttribArray(WALL_ATTRIB_MODEL + c);
+		glVertexAttribDivisorARB(WALL_ATTRIB_MODEL + c, 1);
+	}
+	glEnableVertexAttribArray(WALL_ATTRIB_TINT);
+	glVertexAttribDivisorARB(WALL_ATTRIB_TINT, 1);
+
+	// Instances are laid out wall by wall, so each run of visible walls is a
+	// contiguous instance range
+	bool visible[5];
+	for (int w = 0; w < 4; ++w) {
+		visible[w] = wallVisible(w);
+	}
+	visible[4] = false;
+	const Mesh &cube = primitiveMesh(SHAPE_CUBE, 1, 1, 0);
+	GLsizei cubesPerWall = wallInstancing.cubeInstances / 4;
+	int runStart = -1;
+	for (int w = 0; w <= 4; ++w) {
+		if (visible[w] && runStart < 0) {
+			runStart = w;
+		} else if (!visible[w] && runStart >= 0) {
+			GLsizei walls = w - runStart;
+			bindWallInstances(runStart * cubesPerWall);
+			bindMesh(cube);
+			glDrawElementsInstancedARB(GL_TRIANGLES, cube.indexCount, GL_UNSIGNED_INT, (const GLvoid *)0, cubesPerWall * walls);
+			countDraw((long long)cube.indexCount * cubesPerWall * walls);
+			runStart = -1;
+		}
+	}
+
+	// Rivets go out per run of visible walls sharing the same detail
+	int rivetSlices[5];
+	for (int w = 0; w < 4; ++w) {
+		rivetSlices[w] = visible[w] ? wallRivetSlices(w) : 0;
+	}
+	rivetSlices[4] = 0;
+	GLsizei rivetsPerWall = wallInstancing.rivetInstances / 4;
+	runStart = -1;
+	for (int w = 0; w <= 4; ++w) {
+		if (runStart >= 0 && rivetSlices[w] != rivetSlices[runStart]) {
+			GLsizei walls = w - runStart;
+			const Mesh &rivet = primitiveMesh(SHAPE_SPHERE, rivetSlices[runStart], rivetSlices[runStart], 0);
+			bindWallInstances(wallInstancing.cubeInstances + runStart * rivetsPerWall);
+			bindMesh(rivet);
+			glDrawElementsInstancedARB(GL_TRIANGLES, rivet.indexCount, GL_UNSIGNED_INT, (const GLvoid *)0, rivetsPerWall * walls);
+			countDraw((long long)rivet.indexCount * rivetsPerWall * walls);
+			runStart = -1;
+		}
+		if (runStart < 0 && rivetSlices[w] > 0) {
+			runStart = w;
+		}
+	}
+
+	for (GLuint c = 0; c < WALL_MODEL_COLUMNS; ++c) {
+		glVertexAttribDivisorARB(WALL_ATTRIB_MODEL + c, 0);
+		glDisableVertexAttribArray(WALL_ATTRIB_MODEL + c);
+	}
+	glVertexAttribDivisorARB(WALL_ATTRIB_TINT, 0);
+	glDisableVertexAttribArray(WALL_ATTRIB_TINT);
+	useProgram(0);
 }
 
 void drawWalls() {
-	float height = 0.7f;
-	float thickness = 0.05f;
-	float width = SCENE_HALF * 2.0f;
-	
-	// Back wall (-Z)
-	glPushMatrix();
-	glTranslatef(0.0f, height * 0.5f, -SCENE_HALF);
-	drawWallPanel(width, height, wallColorPhase);
-	glPopMatrix();
-	
-	// Front wall (+Z)
-	glPushMatrix();
-	glTranslatef(0.0f, height * 0.5f, SCENE_HALF);
-	glRotatef(180.0f, 0.0f, 1.0f, 0.0f);
-	drawWallPanel(width, height, wallColorPhase + 1.5f);
-	glPopMatrix();
-	
-	// Left wall (-X)
-	glPushMatrix();
-	glTranslatef(-SCENE_HALF, height * 0.5f, 0.0f);
-	glRotatef(90.0f, 0.0f, 1.0f, 0.0f);
-	drawWallPanel(width, height, wallColorPhase + 3.0f);
-	glPopMatrix();
-	
-	// Right wall (+X)
-	glPushMatrix();
-	glTranslatef(SCENE_HALF, height * 0.5f, 0.0f);
-	glRotatef(-90.0f, 0.0f, 1.0f, 0.0f);
-	drawWallPanel(width, height, wallColorPhase + 4.5f);
-	glPopMatrix();
+	TraceScope trace("drawWalls");
+	if (wallInstancing.program) {
+		drawWallsInstanced();
+		return;
+	}
+	float width = scene.half * 2.0f;
+	for (int w = 0; w < 4; ++w) {
+		if (!wallVisible(w)) {
+			continue;
+		}
+		float wall[16];
+		identityMatrix(wall);
+		applyTranslation(wall, WALLS[w].x * scene.half, WALL_HEIGHT * 0.5f, WALLS[w].z * scene.half);
+		if (WALLS[w].yaw != 0.0f) {
+			applyRotation(wall, WALLS[w].yaw, 0.0f, 1.0f, 0.0f);
+		}
+		drawWallPanel(wall, width, WALL_HEIGHT, renderState.wallColorPhase + WALLS[w].phaseOffset, wallRivetSlices(w));
+	}
+	glLoadMatrixf(viewMatrix);
 }
 
+// Bounding sphere around the player's origin, large enough for any yaw and tilt
+const float PLAYER_BOUND_RADIUS = 0.38f;
+
 void drawPlayer() {
-	glPushMatrix();
-	glTranslatef(player.position.x, player.position.y, player.position.z);
-	glRotatef(player.yaw, 0.0f, 1.0f, 0.0f);
-	glRotatef(player.tilt, 1.0f, 0.0f, 0.0f);
-	
-	// Torso (wetsuit body)
-	glColor3f(0.12f, 0.3f, 0.5f);
-	glPushMatrix();
-	glTranslatef(0.0f, 0.13f, 0.0f);
-	glScalef(0.1f, 0.18f, 0.07f);
-	glutSolidSphere(1.0f, 20, 20);
-	glPopMatrix();
-	
-	// Torso equipment harness
-	glColor3f(0.15f, 0.15f, 0.18f);
-	glPushMatrix();
-	glTranslatef(0.0f, 0.15f, 0.055f);
-	glScalef(0.08f, 0.14f, 0.02f);
-	glutSolidCube(1.0f);
-	glPopMatrix();
-	
-	// Legs (upper)
-	glColor3f(0.1f, 0.25f, 0.42f);
-	glPushMatrix();
-	glTranslatef(-0.035f, 0.05f, 0.0f);
-	glRotatef(-5.0f, 0.0f, 0.0f, 1.0f);
-	glScalef(0.03f, 0.1f, 0.03f);
-	glutSolidSphere(1.0f, 16, 16);
-	glPopMatrix();
-	glPushMatrix();
-	glTranslatef(0.035f, 0.05f, 0.0f);
-	glRotatef(5.0f, 0.0f, 0.0f, 1.0f);
-	glScalef(0.03f, 0.1f, 0.03f);
-	glutSolidSphere(1.0f, 16, 16);
-	glPopMatrix();
-	
-	// Arms (shoulders to elbows)
-	glColor3f(0.1f, 0.25f, 0.42f);
-	glPushMatrix();
-	glTranslatef(-0.08f, 0.18f, 0.0f);
-	glRotatef(-15.0f, 0.0f, 0.0f, 1.0f);
-	glScalef(0.025f, 0.08f, 0.025f);
-	glutSolidSphere(1.0f, 16, 16);
-	glPopMatrix();
-	glPushMatrix();
-	glTranslatef(0.08f, 0.18f, 0.0f);
-	glRotatef(15.0f, 0.0f, 0.0f, 1.0f);
-	glScalef(0.025f, 0.08f, 0.025f);
-	glutSolidSphere(1.0f, 16, 16);
-	glPopMatrix();
-	
-	// Arms (elbows to hands)
-	glPushMatrix();
-	glTranslatef(-0.09f, 0.1f, 0.0f);
-	glRotatef(-10.0f, 0.0f, 0.0f, 1.0f);
-	glScalef(0.022f, 0.07f, 0.022f);
-	glutSolidSphere(1.0f, 14, 14);
-	glPopMatrix();
-	glPushMatrix();
-	glTranslatef(0.09f, 0.1f, 0.0f);
-	glRotatef(10.0f, 0.0f, 0.0f, 1.0f);
-	glScalef(0.022f, 0.07f, 0.022f);
-	glutSolidSphere(1.0f, 14, 14);
-	glPopMatrix();
-	
-	// Helmet (glass dome)
-	glColor3f(0.55f, 0.75f, 0.85f);
-	glPushMatrix();
-	glTranslatef(0.0f, 0.28f, 0.01f);
-	glutSolidSphere(0.065f, 24, 24);
-	glPopMatrix();
-	
-	// Helmet ring collar
-	glColor3f(0.3f, 0.32f, 0.35f);
-	glPushMatrix();
-	glTranslatef(0.0f, 0.23f, 0.0f);
-	glutSolidTorus(0.015f, 0.07f, 12, 20);
-	glPopMatrix();
-	
-	// Backpack/air tank
-	glColor3f(0.25f, 0.27f, 0.3f);
-	glPushMatrix();
-	glTranslatef(0.0f, 0.16f, -0.06f);
-	glScalef(0.06f, 0.12f, 0.04f);
-	glutSolidSphere(1.0f, 16, 16);
-	glPopMatrix();
-	
-	// Face behind visor (darker)
-	glDisable(GL_LIGHTING);
-	glColor4f(0.15f, 0.12f, 0.1f, 0.6f);
-	glPushMatrix();
-	glTranslatef(0.0f, 0.28f, 0.035f);
-	glScalef(0.04f, 0.05f, 0.03f);
-	glutSolidSphere(1.0f, 12, 12);
-	glPopMatrix();
-	glEnable(GL_LIGHTING);
-	
-	glPopMatrix();
+	const Vector3f &p = renderState.playerPosition;
+	if (!sphereVisible(p.x, p.y, p.z, PLAYER_BOUND_RADIUS)) {
+		return;
+	}
+	if (selectLod(p.x, p.y, p.z, PLAYER_BOUND_RADIUS) == LOD_IMPOSTOR) {
+		lodLevel = LOD_COARSE; // the player always keeps its shape
+	}
+	float channels[RIG_MAX_CHANNELS] = { renderState.playerYaw, renderState.playerTilt };
+	poseRig(playerRig, channels, playerPose);
+	drawRig(playerRig, playerPose, p.x, p.y, p.z);
 }
 
-void drawGoalAt(const Goal &goal) {
-	glPushMatrix();
-	glTranslatef(goal.position.x, goal.position.y, goal.position.z);
-	glRotatef(goalRotation, 0.0f, 1.0f, 0.0f);
-	
-	float pulse = 1.0f + 0.15f * sinf(goalRotation * 0.1f);
-	
-	// Outer containment cylinder
-	glColor3f(0.3f, 0.35f, 0.4f);
-	glPushMatrix();
-	glRotatef(90.0f, 1.0f, 0.0f, 0.0f);
-	GLUquadric* quad1 = gluNewQuadric();
-	gluCylinder(quad1, 0.06f, 0.06f, 0.18f, 20, 4);
-	gluDeleteQuadric(quad1);
-	glPopMatrix();
-	
-	// Top and bottom caps
-	glPushMatrix();
-	glTranslatef(0.0f, 0.09f, 0.0f);
-	glRotatef(90.0f, 1.0f, 0.0f, 0.0f);
-	glutSolidCone(0.062f, 0.02f, 20, 1);
-	glPopMatrix();
-	glPushMatrix();
-	glTranslatef(0.0f, -0.09f, 0.0f);
-	glRotatef(-90.0f, 1.0f, 0.0f, 0.0f);
-	glutSolidCone(0.062f, 0.02f, 20, 1);
-	glPopMatrix();
-	
-	// Glowing energy core (pulsing)
-	glDisable(GL_LIGHTING);
-	glColor4f(0.2f, 0.7f, 0.95f, 0.8f);
-	glPushMatrix();
-	glScalef(pulse, pulse, pulse);
-	glutSolidSphere(0.045f, 24, 24);
-	glPopMatrix();
-	
-	// Inner energy glow
-	glColor4f(0.4f, 0.85f, 1.0f, 0.5f);
-	glPushMatrix();
-	glScalef(pulse * 1.2f, pulse * 1.2f, pulse * 1.2f);
-	glutSolidSphere(0.055f, 20, 20);
-	glPopMatrix();
-	glEnable(GL_LIGHTING);
-	
-	// Support stand
-	glColor3f(0.25f, 0.28f, 0.32f);
-	glPushMatrix();
-	glTranslatef(0.0f, -0.12f, 0.0f);
-	glRotatef(90.0f, 1.0f, 0.0f, 0.0f);
-	GLUquadric* quad2 = gluNewQuadric();
-	gluCylinder(quad2, 0.025f, 0.025f, 0.04f, 12, 2);
-	gluDeleteQuadric(quad2);
-	glPopMatrix();
-	
-	// Base platform
-	glPushMatrix();
-	glTranslatef(0.0f, -0.14f, 0.0f);
-	glScalef(0.08f, 0.015f, 0.08f);
-	glutSolidCube(1.0f);
-	glPopMatrix();
-	
-	glPopMatrix();
+// Covers the stand, base and the pulsing glow
+const float GOAL_BOUND_RADIUS = 0.2f;
+
+// The spin and pulse are the same for every goal, so the goal pose is built
+// once per frame and each goal only moves it into place
+void poseGoals() {
+	float rotation = renderState.goalRotation;
+	float channels[RIG_MAX_CHANNELS] = { rotation, 1.0f + 0.15f * sinf(rotation * 0.1f) };
+	poseRig(goalRig, channels, goalPose);
 }
 
-void drawGoals() {
-	for (size_t i = 0; i < goals.size(); ++i) {
-		if (!goals[i].collected) {
-			drawGoalAt(goals[i]);
+// Goals [first, last), at most DRAW_JOB_SIZE of them
+void drawGoalRange(int first, int last) {
+	TraceScope trace("drawGoals");
+	const GoalStore &goals = game.goals;
+	unsigned char visible[DRAW_JOB_SIZE];
+	spheresInFrustum(&goals.x[first], &goals.y[first], &goals.z[first], last - first, 0.0f, GOAL_BOUND_RADIUS, visible);
+	for (int i = first; i < last; ++i) {
+		if (goals.collected[i]) {
+			continue;
+		}
+		if (!visible[i - first]) {
+			++frameCounters.culled;
+			continue;
+		}
+		selectLod(goals.x[i], goals.y[i], goals.z[i], GOAL_BOUND_RADIUS);
+		drawRig(goalRig, goalPose, goals.x[i], goals.y[i], goals.z[i]);
+	}
+}
+
+void drawHudText(float x, float y, const char *text) {
+	if (headless) {
+		return;
+	}
+	glRasterPos2f(x, y);
+	for (const char *c = text; *c; ++c) {
+		glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, *c);
+	}
+}
+
+void drawHud() {
+	TraceScope trace("drawHud");
+	glMatrixMode(GL_PROJECTION);
+	pushMatrix();
+	glLoadIdentity();
+	gluOrtho2D(0.0, 1.0, 0.0, 1.0);
+	glMatrixMode(GL_MODELVIEW);
+	pushMatrix();
+	glLoadIdentity();
+	disableCap(GL_LIGHTING);
+	setDrawColor(0.9f, 0.95f, 0.98f);
+	char info[64];
+	snprintf(info, sizeof(info), "Goals: %d", goalsRemaining(game));
+	drawHudText(0.03f, 0.95f, info);
+	snprintf(info, sizeof(info), "Time: %02d", (int)ceilf(game.remainingTime));
+	drawHudText(0.03f, 0.9f, info);
+	enableCap(GL_LIGHTING);
+	popMatrix();
+	glMatrixMode(GL_PROJECTION);
+	popMatrix();
+	glMatrixMode(GL_MODELVIEW);
+}
+
+void initProfiler() {
+	profiler.gpuSupported = hasExtension("GL_ARB_timer_query") || hasExtension("GL_EXT_timer_query");
+	if (profiler.gpuSupported) {
+		glGenQueries(2 * ZONE_COUNT, &profiler.queries[0][0]);
+	}
+}
+
+void toggleProfiler() {
+	profiler.visible = !profiler.visible;
+	for (int z = 0; z < ZONE_COUNT; ++z) {
+		profiler.issued[0][z] = profiler.issued[1][z] = false;
+		profiler.gpuMillis[z] = 0.0;
+	}
+}
+
+void drawProfilerText(float x, float y, const char *text) {
+	glRasterPos2f(x, y);
+	for (const char *c = text; *c; ++c) {
+		glutBitmapCharacter(GLUT_BITMAP_8_BY_13, *c);
+	}
+}
+
+// Average and worst time per zone over the last PROFILE_HISTORY frames. The
+// zone with the worst single frame is highlighted, which is usually the one
+// behind a visible hitch.
+void drawProfilerOverlay() {
+	TraceScope trace("drawProfilerOverlay");
+	if (!profiler.visible || headless) {
+		return;
+	}
+	int frames = std::min(profiler.frame, PROFILE_HISTORY);
+	if (frames == 0) {
+		return;
+	}
+	double cpuAverage[ZONE_COUNT], cpuWorst[ZONE_COUNT], gpuAverage[ZONE_COUNT];
+	int spikeZone = 0;
+	for (int z = 0; z < ZONE_COUNT; ++z) {
+		cpuAverage[z] = cpuWorst[z] = gpuAverage[z] = 0.0;
+		for (int i = 0; i < frames; ++i) {
+			cpuAverage[z] += profiler.cpuHistory[z][i];
+			cpuWorst[z] = std::max(cpuWorst[z], profiler.cpuHistory[z][i]);
+			gpuAverage[z] += profiler.gpuHistory[z][i];
+		}
+		cpuAverage[z] /= frames;
+		gpuAverage[z] /= frames;
+		if (cpuWorst[z] > cpuWorst[spikeZone]) {
+			spikeZone = z;
+		}
+	}
+
+	glMatrixMode(GL_PROJECTION);
+	pushMatrix();
+	glLoadIdentity();
+	gluOrtho2D(0.0, 1.0, 0.0, 1.0);
+	glMatrixMode(GL_MODELVIEW);
+	pushMatrix();
+	glLoadIdentity();
+	disableCap(GL_LIGHTING);
+	disableCap(GL_DEPTH_TEST);
+	const float left = 0.5f, top = 0.97f, line = 0.032f;
+	setDrawColor(0.0f, 0.05f, 0.1f, 0.6f);
+	glRectf(left - 0.01f, top - line * (ZONE_COUNT + 1.6f), 0.99f, top + 0.02f);
+	setDrawColor(0.7f, 0.85f, 0.95f);
+	drawProfilerText(left, top - line * 0.5f, "zone             cpu avg   max   gpu");
+	char row[64];
+	for (int z = 0; z < ZONE_COUNT; ++z) {
+		if (z == spikeZone) {
+			setDrawColor(1.0f, 0.6f, 0.3f);
+		} else {
+			setDrawColor(0.9f, 0.95f, 0.98f);
+		}
+		if (profiler.gpuTimed[z]) {
+			snprintf(row, sizeof(row), "%-16s %6.2f %6.2f %6.2f", PROFILE_ZONE_NAMES[z], cpuAverage[z], cpuWorst[z], gpuAverage[z]);
+		} else {
+			snprintf(row, sizeof(row), "%-16s %6.2f %6.2f      -", PROFILE_ZONE_NAMES[z], cpuAverage[z], cpuWorst[z]);
+		}
+		drawProfilerText(left, top - line * (z + 1.5f), row);
+	}
+	enableCap(GL_DEPTH_TEST);
+	enableCap(GL_LIGHTING);
+	popMatrix();
+	glMatrixMode(GL_PROJECTION);
+	popMatrix();
+	glMatrixMode(GL_MODELVIEW);
+}
+
+void drawGameResult() {
+	TraceScope trace("drawGameResult");
+	glMatrixMode(GL_PROJECTION);
+	pushMatrix();
+	glLoadIdentity();
+	gluOrtho2D(0.0, 1.0, 0.0, 1.0);
+	glMatrixMode(GL_MODELVIEW);
+	pushMatrix();
+	glLoadIdentity();
+	disableCap(GL_LIGHTING);
+	const char *headline = game.state == STATE_WIN ? "GAME WIN" : "GAME LOSE";
+	setDrawColor(1.0f, 0.95f, 0.6f);
+	drawHudText(0.4f, 0.55f, headline);
+	setDrawColor(0.85f, 0.9f, 0.95f);
+	drawHudText(0.25f, 0.45f, "Press P to restart");
+	enableCap(GL_LIGHTING);
+	popMatrix();
+	glMatrixMode(GL_PROJECTION);
+	popMatrix();
+	glMatrixMode(GL_MODELVIEW);
+}
+
+// Bounding sphere of each model relative to its prop position, covering every
+// animation phase (open airlock doors, drone bob, console pulse)
+struct PropBounds {
+	float centerY;
+	float radius;
+};
+
+const PropBounds PROP_BOUNDS[MODEL_COUNT] = {
+	{ 0.15f, 0.25f }, // floodlight
+	{ 0.3f, 0.55f },  // airlock
+	{ 0.18f, 0.27f }, // coral
+	{ 0.07f, 0.32f }, // console
+	{ 0.19f, 0.35f }  // drone
+};
+
+// Stand-in box drawn for a prop below the last LOD threshold, in the model's
+// dominant color
+struct PropImpostor {
+	float color[3];
+	float centerY;
+	float size[3];
+};
+
+const PropImpostor PROP_IMPOSTORS[MODEL_COUNT] = {
+	{ { 0.2f, 0.24f, 0.28f }, 0.15f, { 0.16f, 0.3f, 0.18f } },  // floodlight
+	{ { 0.25f, 0.3f, 0.35f }, 0.3f, { 0.52f, 0.6f, 0.4f } },    // airlock
+	{ { 0.58f, 0.25f, 0.6f }, 0.18f, { 0.2f, 0.3f, 0.2f } },    // coral
+	{ { 0.26f, 0.32f, 0.38f }, 0.07f, { 0.28f, 0.26f, 0.36f } }, // console
+	{ { 0.65f, 0.2f, 0.3f }, 0.16f, { 0.34f, 0.1f, 0.34f } }    // drone
+};
+
+// Records the box straight into the queue, with its world matrix built in
+// place like a rig part's
+void drawPropImpostor(int model, float x, float y, float z) {
+	const PropImpostor &impostor = PROP_IMPOSTORS[model];
+	renderQueue.packets.push_back(RenderPacket());
+	RenderPacket &packet = renderQueue.packets.back();
+	packet.mesh = &primitiveMesh(SHAPE_CUBE, 1, 1, 0);
+	identityMatrix(packet.model);
+	applyScale(packet.model, impostor.size[0], impostor.size[1], impostor.size[2]);
+	packet.model[12] = x;
+	packet.model[13] = y + impostor.centerY;
+	packet.model[14] = z;
+	memcpy(packet.color, impostor.color, sizeof(impostor.color));
+	packet.color[3] = 1.0f;
+	packet.lighting = true;
+	packet.key = renderKey(packet);
+}
+
+// Occlusion culling for props. Once the ground, walls and airlocks are down
+// (the airlock packets are flushed from the render queue first),
+// every other prop in the frustum gets its bounding box drawn inside a
+// GL_SAMPLES_PASSED query with color and depth writes off. The result is read
+// the next frame, and only if it is already available, so the CPU never waits
+// on the GPU; a prop whose last result saw no samples is skipped. Until a
+// query answers, the previous answer stands.
+struct OcclusionCuller {
+	bool supported;
+	bool enabled;
+	std::vector<GLuint> queries; // one per prop
+	std::vector<unsigned char> pending;
+	std::vector<unsigned char> occluded;
+};
+
+OcclusionCuller occlusion = { false, true, std::vector<GLuint>(), std::vector<unsigned char>(), std::vector<unsigned char>() };
+
+const PropModel OCCLUDER_MODEL = MODEL_AIRLOCK; // drawn before the queries and never tested
+
+void initOcclusion() {
+	occlusion.supported = hasExtension("GL_ARB_occlusion_query") || atof((const char *)glGetString(GL_VERSION)) >= 1.5;
+}
+
+void resizeOcclusion(size_t count) {
+	size_t old = occlusion.queries.size();
+	if (count <= old) {
+		return;
+	}
+	occlusion.queries.resize(count);
+	occlusion.pending.resize(count, 0);
+	occlusion.occluded.resize(count, 0);
+	glGenQueries((GLsizei)(count - old), &occlusion.queries[old]);
+}
+
+void issueOcclusionQueries() {
+	TraceScope trace("issueOcclusionQueries");
+	const PropStore &props = game.props;
+	if (!occlusion.supported || !occlusion.enabled) {
+		return;
+	}
+	resizeOcclusion(props.size());
+	const Mesh &box = primitiveMesh(SHAPE_CUBE, 1, 1, 0);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+	disableCap(GL_LIGHTING);
+	countStateChanges(2);
+	for (int m = 0; m < MODEL_COUNT; ++m) {
+		if (m == OCCLUDER_MODEL) {
+			continue;
+		}
+		const PropBounds &bounds = PROP_BOUNDS[m];
+		for (int i = props.modelStart[m]; i < props.modelStart[m + 1]; ++i) {
+			if (occlusion.pending[i]) {
+				GLuint available = 0;
+				glGetQueryObjectuiv(occlusion.queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+				if (available) {
+					GLuint samples = 0;
+					glGetQueryObjectuiv(occlusion.queries[i], GL_QUERY_RESULT, &samples);
+					occlusion.occluded[i] = samples == 0;
+					occlusion.pending[i] = 0;
+				}
+			}
+			float centerY = props.y[i] + bounds.centerY;
+			// Out of view, or close enough that the near plane could clip the
+			// box: draw it as soon as it shows up
+			if (!sphereInFrustum(props.x[i], centerY, props.z[i], bounds.radius) ||
+				(Vector3f(props.x[i], centerY, props.z[i]) - camera.eye).length() < bounds.radius * 1.75f + CAMERA_NEAR) {
+				occlusion.occluded[i] = 0;
+				continue;
+			}
+			if (occlusion.pending[i]) {
+				continue;
+			}
+			glBeginQuery(GL_SAMPLES_PASSED, occlusion.queries[i]);
+			pushMatrix();
+			glTranslatef(props.x[i], centerY, props.z[i]);
+			drawScaledMesh(box, bounds.radius * 2.0f, bounds.radius * 2.0f, bounds.radius * 2.0f);
+			popMatrix();
+			glEndQuery(GL_SAMPLES_PASSED);
+			occlusion.pending[i] = 1;
+		}
+	}
+	enableCap(GL_LIGHTING);
+	glDepthMask(GL_TRUE);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	countStateChanges(2);
+}
+
+// Reads last frame's answers only, so any thread may ask while recording
+bool propOccluded(int i) {
+	if (!occlusion.supported || !occlusion.enabled || i >= (int)occlusion.occluded.size() || !occlusion.occluded[i]) {
+		return false;
+	}
+	++frameCounters.occluded;
+	return true;
+}
+
+// Props [first, last) of model m, a slice of its sorted range of at most
+// DRAW_JOB_SIZE props
+void drawPropRange(int m, int first, int last) {
+	const PropStore &props = game.props;
+	const PropBounds &bounds = PROP_BOUNDS[m];
+	unsigned char visible[DRAW_JOB_SIZE];
+	spheresInFrustum(&props.x[first], &props.y[first], &props.z[first], last - first, bounds.centerY, bounds.radius, visible);
+	for (int i = first; i < last; ++i) {
+		float centerY = props.y[i] + bounds.centerY;
+		if (!visible[i - first]) {
+			++frameCounters.culled;
+			continue;
+		}
+		if (propOccluded(i)) {
+			continue;
+		}
+		if (selectLod(props.x[i], centerY, props.z[i], bounds.radius) == LOD_IMPOSTOR) {
+			drawPropImpostor(m, props.x[i], props.y[i], props.z[i]);
+			continue;
+		}
+		float channels[RIG_MAX_CHANNELS] = {};
+		PROP_CHANNELS[m](renderState.phases[i], channels);
+		poseRig(propRigs[m], channels, propPoses[i]);
+		drawRig(propRigs[m], propPoses[i], props.x[i], props.y[i], props.z[i]);
+	}
+}
+
+// Scene traversal jobs. Props (in slices of one model's sorted range), goals
+// and the player are recorded as independent jobs, each into its own packet
+// list, by a pool of draw workers with the main thread taking jobs as well.
+// The recording state (render queue, LOD level, counters) is per thread and
+// traversal only reads the scene, the camera, last frame's occlusion answers
+// and the meshes built at startup, so jobs need no locking. The main thread
+// appends the lists in job order, which gives the same packets in the same
+// order as a serial walk, and does all GL work.
+enum DrawJobKind {
+	JOB_PROPS,
+	JOB_GOALS,
+	JOB_PLAYER
+};
+
+struct DrawJob {
+	DrawJobKind kind;
+	int model; // JOB_PROPS only
+	int first; // prop or goal range
+	int last;
+	std::vector<RenderPacket> packets;
+	int culled;
+	int occluded;
+	int transforms;
+	double millis; // recording time, charged to the model, goal or player zone
+};
+
+struct DrawWorkers {
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable wake;     // a batch was posted, or quit
+	std::condition_variable finished; // the batch is done and no worker is in it
+	std::vector<DrawJob> *jobs;
+	std::atomic<size_t> next; // next job to take
+	size_t done;
+	int active; // workers inside the current batch
+	unsigned int batch;
+	bool quit;
+};
+
+DrawWorkers drawWorkers;
+int drawThreads = -1; // workers besides the main thread; -1 means one per extra core
+std::vector<DrawJob> occluderJobs;
+std::vector<DrawJob> sceneJobs;
+
+void runDrawJob(DrawJob &job) {
+	TraceScope trace("runDrawJob");
+	double start = nowMillis();
+	RenderCounters counters = frameCounters;
+	memset(&frameCounters, 0, sizeof(frameCounters));
+	std::vector<RenderPacket> pending;
+	pending.swap(renderQueue.packets);
+	job.packets.clear();
+	renderQueue.packets.swap(job.packets); // record into the job's storage
+	beginRenderQueue();
+	switch (job.kind) {
+	case JOB_PROPS:
+		drawPropRange(job.model, job.first, job.last);
+		break;
+	case JOB_GOALS:
+		drawGoalRange(job.first, job.last);
+		break;
+	case JOB_PLAYER:
+		drawPlayer();
+		break;
+	}
+	renderQueue.recording = false;
+	renderQueue.packets.swap(job.packets);
+	renderQueue.packets.swap(pending);
+	lodLevel = LOD_FULL;
+	job.culled = frameCounters.culled;
+	job.occluded = frameCounters.occluded;
+	job.transforms = frameCounters.transforms;
+	frameCounters = counters;
+	job.millis = nowMillis() - start;
+}
+
+// Takes jobs from the posted batch until none are left
+size_t takeDrawJobs(std::vector<DrawJob> &jobs) {
+	size_t ran = 0;
+	for (size_t i = drawWorkers.next++; i < jobs.size(); i = drawWorkers.next++) {
+		runDrawJob(jobs[i]);
+		++ran;
+	}
+	return ran;
+}
+
+void drawWorkerMain(int index) {
+	char name[32];
+	snprintf(name, sizeof(name), "drawWorker %d", index);
+	traceThreadName(name);
+	unsigned int seen = 0;
+	for (;;) {
+		std::vector<DrawJob> *jobs;
+		{
+			std::unique_lock<std::mutex> lock(drawWorkers.mutex);
+			drawWorkers.wake.wait(lock, [&]() { return drawWorkers.quit || drawWorkers.batch != seen; });
+			if (drawWorkers.quit) {
+				return;
+			}
+			seen = drawWorkers.batch;
+			jobs = drawWorkers.jobs;
+			++drawWorkers.active;
+		}
+		size_t ran = takeDrawJobs(*jobs);
+		std::lock_guard<std::mutex> lock(drawWorkers.mutex);
+		drawWorkers.done += ran;
+		if (--drawWorkers.active == 0) {
+			drawWorkers.finished.notify_one();
 		}
 	}
 }
 
-void drawHudText(float x, float y, const char *text) {
-	glRasterPos2f(x, y);
-	for (const char *c = text; *c; ++c) {
-		glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, *c);
+void stopDrawWorkers() {
+	{
+		std::lock_guard<std::mutex> lock(drawWorkers.mutex);
+		drawWorkers.quit = true;
 	}
+	drawWorkers.wake.notify_all();
+	for (size_t i = 0; i < drawWorkers.threads.size(); ++i) {
+		drawWorkers.threads[i].join();
+	}
+	drawWorkers.threads.clear();
 }
 
-void drawHud() {
-	glMatrixMode(GL_PROJECTION);
-	glPushMatrix();
-	glLoadIdentity();
-	gluOrtho2D(0.0, 1.0, 0.0, 1.0);
-	glMatrixMode(GL_MODELVIEW);
-	glPushMatrix();
-	glLoadIdentity();
-	glDisable(GL_LIGHTING);
-	glColor3f(0.9f, 0.95f, 0.98f);
-	char info[64];
-	snprintf(info, sizeof(info), "Goals: %d", goalsRemaining());
-	drawHudText(0.03f, 0.95f, info);
-	snprintf(info, sizeof(info), "Time: %02d", (int)ceilf(remainingTime));
-	drawHudText(0.03f, 0.9f, info);
-	glEnable(GL_LIGHTING);
-	glPopMatrix();
-	glMatrixMode(GL_PROJECTION);
-	glPopMatrix();
-	glMatrixMode(GL_MODELVIEW);
+void initDrawWorkers() {
+	if (drawThreads < 0) {
+		unsigned int cores = std::thread::hardware_concurrency();
+		drawThreads = cores > 1 ? (int)cores - 1 : 0;
+	}
+	for (int i = 0; i < drawThreads; ++i) {
+		drawWorkers.threads.push_back(std::thread(drawWorkerMain, i));
+	}
+	if (drawThreads > 0) {
+		atexit(stopDrawWorkers);
+	}
 }
 
-void drawGameResult() {
-	glMatrixMode(GL_PROJECTION);
-	glPushMatrix();
-	glLoadIdentity();
-	gluOrtho2D(0.0, 1.0, 0.0, 1.0);
-	glMatrixMode(GL_MODELVIEW);
-	glPushMatrix();
-	glLoadIdentity();
-	glDisable(GL_LIGHTING);
-	const char *headline = gameState == STATE_WIN ? "GAME WIN" : "GAME LOSE";
-	glColor3f(1.0f, 0.95f, 0.6f);
-	glRasterPos2f(0.4f, 0.55f);
-	for (const char *c = headline; *c; ++c) {
-		glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, *c);
+// Runs a batch across the workers and the calling thread and returns once
+// every job is done. Without workers the jobs simply run here in order.
+void runDrawJobs(std::vector<DrawJob> &jobs) {
+	if (drawWorkers.threads.empty()) {
+		for (size_t i = 0; i < jobs.size(); ++i) {
+			runDrawJob(jobs[i]);
+		}
+		return;
 	}
-	glColor3f(0.85f, 0.9f, 0.95f);
-	glRasterPos2f(0.25f, 0.45f);
-	const char *hint = "Press P to restart";
-	for (const char *c = hint; *c; ++c) {
-		glutBitmapCharacter(GLUT_BITMAP_HELVETICA_18, *c);
+	{
+		std::unique_lock<std::mutex> lock(drawWorkers.mutex);
+		drawWorkers.finished.wait(lock, [&]() { return drawWorkers.active == 0; });
+		drawWorkers.jobs = &jobs;
+		drawWorkers.next = 0;
+		drawWorkers.done = 0;
+		++drawWorkers.batch;
 	}
-	glEnable(GL_LIGHTING);
-	glPopMatrix();
-	glMatrixMode(GL_PROJECTION);
-	glPopMatrix();
-	glMatrixMode(GL_MODELVIEW);
+	drawWorkers.wake.notify_all();
+	size_t ran = takeDrawJobs(jobs);
+	std::unique_lock<std::mutex> lock(drawWorkers.mutex);
+	drawWorkers.done += ran;
+	drawWorkers.finished.wait(lock, [&]() { return drawWorkers.done == jobs.size() && drawWorkers.active == 0; });
 }
 
-void drawScene() {
-	drawGround();
-	drawWalls();
-	glPushMatrix();
-	glTranslatef(-0.75f, 0.0f, -0.65f);
-	drawFloodlight(objectControllers[0].phase * 60.0f);
-	glPopMatrix();
-	glPushMatrix();
-	glTranslatef(0.0f, 0.0f, -0.95f);
-	drawAirlock(objectControllers[1].phase);
-	glPopMatrix();
-	glPushMatrix();
-	glTranslatef(0.68f, 0.0f, -0.35f);
-	drawCoralCluster(objectControllers[2].phase);
-	glPopMatrix();
-	glPushMatrix();
-	glTranslatef(-0.55f, 0.0f, 0.55f);
-	drawConsole(objectControllers[3].phase);
-	glPopMatrix();
-	glPushMatrix();
-	glTranslatef(0.45f, 0.0f, 0.75f);
-	drawDrone(objectControllers[4].phase);
-	glPopMatrix();
-	drawGoals();
-	drawPlayer();
+void addDrawJob(std::vector<DrawJob> &jobs, size_t &count, DrawJobKind kind, int model, int first, int last) {
+	if (count == jobs.size()) {
+		jobs.resize(count + 1);
+	}
+	DrawJob &job = jobs[count++];
+	job.kind = kind;
+	job.model = model;
+	job.first = first;
+	job.last = last;
 }
 
-float clampf(float v, float minVal, float maxVal) {
-	if (v < minVal) {
-		return minVal;
+void addPropJobs(std::vector<DrawJob> &jobs, size_t &count, int m) {
+	const PropStore &props = game.props;
+	for (int first = props.modelStart[m]; first < props.modelStart[m + 1]; first += DRAW_JOB_SIZE) {
+		addDrawJob(jobs, count, JOB_PROPS, m, first, std::min(first + DRAW_JOB_SIZE, props.modelStart[m + 1]));
 	}
-	if (v > maxVal) {
-		return maxVal;
+}
+
+// Appends every job's packets to the render queue in job order and adds its
+// counters and recording time to the frame's
+void mergeDrawJobs(const std::vector<DrawJob> &jobs) {
+	for (size_t i = 0; i < jobs.size(); ++i) {
+		const DrawJob &job = jobs[i];
+		renderQueue.packets.insert(renderQueue.packets.end(), job.packets.begin(), job.packets.end());
+		frameCounters.culled += job.culled;
+		frameCounters.occluded += job.occluded;
+		frameCounters.transforms += job.transforms;
+		ProfileZone zone = job.kind == JOB_PROPS ? (ProfileZone)(ZONE_FLOODLIGHT + job.model) : job.kind == JOB_GOALS ? ZONE_GOALS : ZONE_PLAYER;
+		zoneMillis[zone] += job.millis;
 	}
-	return v;
 }
 
-void handlePlayerMovement(float dt) {
-	Vector3f direction;
-	if (moveForward) {
-		direction.z -= 1.0f;
+// The occluder model is recorded and drawn first so the occlusion queries
+// see its depth; everything else is recorded in one batch after the queries.
+// Drawing the occluders is charged to the occluder model's zone, so the
+// occlusion zone only covers issuing the queries.
+void drawProps() {
+	propPoses.resize(game.props.size());
+	poseGoals();
+	size_t count = 0;
+	addPropJobs(occluderJobs, count, OCCLUDER_MODEL);
+	occluderJobs.resize(count);
+	runDrawJobs(occluderJobs);
+	mergeDrawJobs(occluderJobs);
+	{
+		ProfileScope scope((ProfileZone)(ZONE_FLOODLIGHT + OCCLUDER_MODEL));
+		executeRenderQueue(true);
 	}
-	if (moveBackward) {
-		direction.z += 1.0f;
+	{
+		ProfileScope scope(ZONE_OCCLUSION);
+		issueOcclusionQueries();
 	}
-	if (moveLeft) {
-		direction.x -= 1.0f;
+
+	count = 0;
+	for (int m = 0; m < MODEL_COUNT; ++m) {
+		if (m != OCCLUDER_MODEL) {
+			addPropJobs(sceneJobs, count, m);
+		}
 	}
-	if (moveRight) {
-		direction.x += 1.0f;
+	for (int first = 0; first < (int)game.goals.size(); first += DRAW_JOB_SIZE) {
+		addDrawJob(sceneJobs, count, JOB_GOALS, 0, first, std::min(first + DRAW_JOB_SIZE, (int)game.goals.size()));
 	}
-	if (direction.length() > 0.0f) {
-		Vector3f dirUnit = direction.unit();
-		player.position += dirUnit * (PLAYER_SPEED * dt);
-		player.yaw = atan2f(dirUnit.x, -dirUnit.z) * 180.0f / 3.14159265f;
+	addDrawJob(sceneJobs, count, JOB_PLAYER, 0, 0, 0);
+	sceneJobs.resize(count);
+	runDrawJobs(sceneJobs);
+	mergeDrawJobs(sceneJobs);
+}
+
+void drawScene() {
+	TraceScope trace("drawScene");
+	{
+		ProfileScope scope(ZONE_GROUND);
+		drawGround();
 	}
-	if (moveUp) {
-		player.position.y += PLAYER_ASCEND_SPEED * dt;
+	{
+		ProfileScope scope(ZONE_WALLS);
+		drawWalls();
 	}
-	if (moveDown) {
-		player.position.y -= PLAYER_ASCEND_SPEED * dt;
+	drawProps();
+	{
+		ProfileScope scope(ZONE_RENDER_QUEUE);
+		executeRenderQueue(false);
 	}
-	float minY = PLAYER_RADIUS;
-	float wallThickness = 0.03f;
-	player.position.x = clampf(player.position.x, -SCENE_HALF + PLAYER_RADIUS + wallThickness, SCENE_HALF - PLAYER_RADIUS - wallThickness);
-	player.position.z = clampf(player.position.z, -SCENE_HALF + PLAYER_RADIUS + wallThickness, SCENE_HALF - PLAYER_RADIUS - wallThickness);
-	player.position.y = clampf(player.position.y, minY, MAX_HEIGHT);
-	bool onGround = fabsf(player.position.y - minY) < 0.002f;
-	player.airborne = !onGround;
-	player.tilt = player.airborne ? -20.0f : 0.0f;
 }
 
-void handleGoalCollection() {
-	for (size_t i = 0; i < goals.size(); ++i) {
-		if (!goals[i].collected) {
-			Vector3f diff = player.position - goals[i].position;
-			if (diff.length() < GOAL_RADIUS) {
-				goals[i].collected = true;
-				if (goalAvailable) {
-					playEffect(SOUND_GOAL);
-				}
-			}
-		}
-	}
-	if (goalsRemaining() == 0 && gameState == STATE_PLAYING) {
-		gameState = STATE_WIN;
-	}
+// Fills `state` in place so the per-step capture reuses its phase storage
+void captureState(RenderState &state) {
+	state.playerPosition = game.player.position;
+	state.playerYaw = game.player.yaw;
+	state.playerTilt = game.player.tilt;
+	state.phases.assign(game.props.phase.begin(), game.props.phase.end());
+	state.goalRotation = game.goalRotation;
+	state.wallColorPhase = game.wallColorPhase;
 }
 
-void updateAnimations(float dt) {
-	float speed[5] = { 1.2f, 0.9f, 1.6f, 2.0f, 1.4f };
-	for (int i = 0; i < 5; ++i) {
-		if (objectControllers[i].active) {
-			objectControllers[i].phase += dt * speed[i];
-		}
-	}
+float lerpf(float a, float b, float t) {
+	return a + (b - a) * t;
 }
 
-void updateGame(float dt) {
-	static bool ytOpened = false;
-	if (gameState != STATE_PLAYING) {
-		return;
-	}
-	remainingTime -= dt;
+// Interpolates yaw along the shorter arc so a wrap at +-180 doesn't spin the diver
+float lerpAngle(float a, float b, float t) {
+	float delta = fmodf(b - a + 540.0f, 360.0f) - 180.0f;
+	return a + delta * t;
+}
 
-	    // Open YouTube link at 75 seconds
-	    if (!ytOpened && remainingTime <= 78.0f) {
-	#if defined(__APPLE__)
-		std::string cmd = "open '" + std::string(YOUTUBE_LINK) + "'";
-		system(cmd.c_str());
-	#elif defined(_WIN32)
-		std::string cmd = "start " + std::string(YOUTUBE_LINK);
-		system(cmd.c_str());
-	#endif
-		ytOpened = true;
-	    }
+void syncRenderState() {
+	captureState(renderState);
+	previousState = renderState;
+}
 
-	// At 10 seconds remaining, stop music and play the buzzer
-	if (remainingTime <= 10.0f && !loseSoundPlayed) {
-		stopBackgroundMusic();  // Stop Crab Rave
-		if (buzzerAvailable) {
-			playEffect(SOUND_BUZZER);
-		}
-		loseSoundPlayed = true;
+void advanceSimulation(float frameTime) {
+	if (frameTime > MAX_FRAME_TIME) {
+		frameTime = MAX_FRAME_TIME;
 	}
-
-	if (remainingTime <= 0.0f) {
-		remainingTime = 0.0f;
-		gameState = goalsRemaining() == 0 ? STATE_WIN : STATE_LOSE;
+	simAccumulator += frameTime;
+	while (simAccumulator >= SIM_STEP) {
+		applyReplayInputs(simTick);
+		captureState(previousState);
+		updateGame(SIM_STEP);
+		++simTick;
+		simAccumulator -= SIM_STEP;
+	}
+	float alpha = simAccumulator / SIM_STEP;
+	RenderState &current = currentState;
+	captureState(current);
+	renderState.playerPosition = previousState.playerPosition + (current.playerPosition - previousState.playerPosition) * alpha;
+	renderState.playerYaw = lerpAngle(previousState.playerYaw, current.playerYaw, alpha);
+	renderState.playerTilt = lerpf(previousState.playerTilt, current.playerTilt, alpha);
+	renderState.phases.resize(current.phases.size());
+	const float *from = previousState.phases.data();
+	const float *to = current.phases.data();
+	float *phases = renderState.phases.data();
+	for (size_t i = 0; i < renderState.phases.size(); ++i) {
+		phases[i] = from[i] + (to[i] - from[i]) * alpha;
 	}
-	goalRotation += dt * 50.0f;
-	wallColorPhase += dt * 0.7f;
-	handlePlayerMovement(dt);
-	updateAnimations(dt);
-	handleGoalCollection();
+	renderState.goalRotation = lerpf(previousState.goalRotation, current.goalRotation, alpha);
+	renderState.wallColorPhase = lerpf(previousState.wallColorPhase, current.wallColorPhase, alpha);
 }
 
 void Display() {
+	TraceScope trace("Display");
 	setupCamera();
 	setupLights();
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	if (gameState == STATE_PLAYING) {
-		drawScene();
-		drawHud();
-	} else {
-		drawScene();
-		drawGameResult();
+	drawScene();
+	{
+		ProfileScope scope(ZONE_HUD);
+		if (game.state == STATE_PLAYING) {
+			drawHud();
+		} else {
+			drawGameResult();
+		}
 	}
+	drawProfilerOverlay();
 
-	glutSwapBuffers();
+	presentFrame();
+	finishProfileFrame();
+	finishTraceFrame();
 }
 
 void toggleAnimation(int index) {
-	if (index < 0 || index >= 5) {
+	if (index < 0 || index >= (int)game.props.size()) {
 		return;
 	}
-	objectControllers[index].active = !objectControllers[index].active;
-	if (servoAvailable) {
-		playEffect(SOUND_SERVO);
-	}
+	game.props.active[index] = !game.props.active[index];
+	playEffect(SOUND_ASSET_SERVO);
 }
 
 void toggleAllAnimations() {
-	for (int i = 0; i < 5; ++i) {
-		objectControllers[i].active = true;
-	}
-	if (servoAvailable) {
-		playEffect(SOUND_SERVO);
-	}
+	setPropsActive(game.props, true);
+	playEffect(SOUND_ASSET_SERVO);
 }
 
 void stopAllAnimations() {
-	for (int i = 0; i < 5; ++i) {
-		objectControllers[i].active = false;
-	}
-	if (servoAvailable) {
-		playEffect(SOUND_SERVO);
-	}
+	setPropsActive(game.props, false);
+	playEffect(SOUND_ASSET_SERVO);
 }
 
-void Keyboard(unsigned char key, int, int) {
+void handleKeyDown(unsigned char key) {
 	float d = 0.05f;
 	switch (key) {
 	case 'w':
@@ -1265,22 +5317,22 @@ void Keyboard(unsigned char key, int, int) {
 		camera.moveZ(-d);
 		break;
 	case 'i':
-		moveForward = true;
+		game.moveForward = true;
 		break;
 	case 'k':
-		moveBackward = true;
+		game.moveBackward = true;
 		break;
 	case 'j':
-		moveLeft = true;
+		game.moveLeft = true;
 		break;
 	case 'l':
-		moveRight = true;
+		game.moveRight = true;
 		break;
 	case 'r':
-		moveUp = true;
+		game.moveUp = true;
 		break;
 	case 'f':
-		moveDown = true;
+		game.moveDown = true;
 		break;
 	case '1':
 		setFrontView();
@@ -1305,35 +5357,36 @@ void Keyboard(unsigned char key, int, int) {
 		resetGame();
 		break;
 	case GLUT_KEY_ESCAPE:
+		finishRecording();
 		stopBackgroundMusic();
 		exit(EXIT_SUCCESS);
 	}
 }
 
-void KeyboardUp(unsigned char key, int, int) {
+void handleKeyUp(unsigned char key) {
 	switch (key) {
 	case 'i':
-		moveForward = false;
+		game.moveForward = false;
 		break;
 	case 'k':
-		moveBackward = false;
+		game.moveBackward = false;
 		break;
 	case 'j':
-		moveLeft = false;
+		game.moveLeft = false;
 		break;
 	case 'l':
-		moveRight = false;
+		game.moveRight = false;
 		break;
 	case 'r':
-		moveUp = false;
+		game.moveUp = false;
 		break;
 	case 'f':
-		moveDown = false;
+		game.moveDown = false;
 		break;
 	}
 }
 
-void Special(int key, int, int) {
+void handleSpecialKey(int key) {
 	float a = 1.5f;
 	switch (key) {
 	case GLUT_KEY_UP:
@@ -1351,6 +5404,154 @@ void Special(int key, int, int) {
 	}
 }
 
+// Input recording and replay. Every keyboard event is stamped with the
+// simulation tick it takes effect on, so a recording replays the exact same
+// session on top of the fixed-step simulation.
+enum InputEventType {
+	INPUT_KEY_DOWN = 1,
+	INPUT_KEY_UP = 2,
+	INPUT_SPECIAL = 3,
+	INPUT_END = 4 // marks the tick the recorded session ended on
+};
+
+struct InputEvent {
+	unsigned int tick;
+	unsigned char type;
+	unsigned char key;
+};
+
+// File layout: "ARRP", u16 version, u16 tick rate, then 6-byte records of
+// u32 tick, u8 type, u8 key. All integers are little-endian.
+const char INPUT_FILE_MAGIC[4] = { 'A', 'R', 'R', 'P' };
+const unsigned short INPUT_FILE_VERSION = 1;
+const int INPUT_RECORD_SIZE = 6;
+
+struct InputRecorder {
+	FILE *file;
+};
+
+struct InputReplay {
+	std::vector<InputEvent> events;
+	size_t next;
+	unsigned int endTick;
+	bool active;
+	bool fast; // step a fixed 1/60 s per frame instead of following the wall clock
+};
+
+InputRecorder recorder = { NULL };
+InputReplay replay = { std::vector<InputEvent>(), 0, 0, false, false };
+
+void writeInputEvent(const InputEvent &event) {
+	writeLittleEndian(recorder.file, event.tick, 4);
+	fputc(event.type, recorder.file);
+	fputc(event.key, recorder.file);
+}
+
+bool startRecording(const char *path) {
+	recorder.file = fopen(path, "wb");
+	if (!recorder.file) {
+		return false;
+	}
+	fwrite(INPUT_FILE_MAGIC, 1, sizeof(INPUT_FILE_MAGIC), recorder.file);
+	writeLittleEndian(recorder.file, INPUT_FILE_VERSION, 2);
+	writeLittleEndian(recorder.file, (unsigned int)(1.0f / SIM_STEP + 0.5f), 2);
+	return true;
+}
+
+void finishRecording() {
+	if (!recorder.file) {
+		return;
+	}
+	InputEvent end = { simTick, INPUT_END, 0 };
+	writeInputEvent(end);
+	fclose(recorder.file);
+	recorder.file = NULL;
+}
+
+bool loadReplay(const char *path) {
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		return false;
+	}
+	unsigned char header[8];
+	bool valid = fread(header, 1, sizeof(header), file) == sizeof(header)
+		&& memcmp(header, INPUT_FILE_MAGIC, sizeof(INPUT_FILE_MAGIC)) == 0
+		&& readLittleEndian(header + 4, 2) == INPUT_FILE_VERSION
+		&& readLittleEndian(header + 6, 2) == (unsigned int)(1.0f / SIM_STEP + 0.5f);
+	replay.events.clear();
+	replay.endTick = 0;
+	unsigned char record[INPUT_RECORD_SIZE];
+	while (valid && fread(record, 1, sizeof(record), file) == sizeof(record)) {
+		InputEvent event = { readLittleEndian(record, 4), record[4], record[5] };
+		if (event.type == INPUT_END) {
+			replay.endTick = event.tick;
+			break;
+		}
+		replay.events.push_back(event);
+		replay.endTick = event.tick;
+	}
+	fclose(file);
+	replay.next = 0;
+	replay.active = valid;
+	return valid;
+}
+
+bool replayFinished() {
+	return replay.active && replay.next >= replay.events.size() && simTick >= replay.endTick;
+}
+
+void applyInput(const InputEvent &event) {
+	switch (event.type) {
+	case INPUT_KEY_DOWN:
+		handleKeyDown(event.key);
+		break;
+	case INPUT_KEY_UP:
+		handleKeyUp(event.key);
+		break;
+	case INPUT_SPECIAL:
+		handleSpecialKey(event.key);
+		break;
+	}
+}
+
+// Called before simulating `tick`; applies every recorded event due by then
+void applyReplayInputs(unsigned int tick) {
+	while (replay.active && replay.next < replay.events.size() && replay.events[replay.next].tick <= tick) {
+		applyInput(replay.events[replay.next++]);
+	}
+}
+
+// Live input takes effect before the next simulation step, which is the tick
+// it gets recorded under. While a replay runs only ESC gets through.
+void submitLiveInput(unsigned char type, int key) {
+	if (replay.active && !(type == INPUT_KEY_DOWN && key == GLUT_KEY_ESCAPE)) {
+		return;
+	}
+	InputEvent event = { simTick, type, (unsigned char)key };
+	if (recorder.file && key != GLUT_KEY_ESCAPE) {
+		writeInputEvent(event);
+	}
+	applyInput(event);
+}
+
+void Keyboard(unsigned char key, int, int) {
+	submitLiveInput(INPUT_KEY_DOWN, key);
+}
+
+void KeyboardUp(unsigned char key, int, int) {
+	submitLiveInput(INPUT_KEY_UP, key);
+}
+
+// F3 toggles the profiler overlay; it is not game input, so it is neither
+// recorded nor blocked during a replay
+void Special(int key, int, int) {
+	if (key == GLUT_KEY_F3) {
+		toggleProfiler();
+		return;
+	}
+	submitLiveInput(INPUT_SPECIAL, key);
+}
+
 void setFrontView() {
 	camera.eye = Vector3f(0.0f, 0.8f, 2.0f);
 	camera.center = Vector3f(0.0f, 0.3f, 0.0f);
@@ -1375,38 +5576,450 @@ void setFreeView() {
 	camera.up = Vector3f(0.0f, 1.0f, 0.0f);
 }
 
+// GL state and cached geometry shared by the window and the headless benchmark
+void initRendering() {
+	invalidateGLState();
+	glClearColor(0.03f, 0.12f, 0.18f, 1.0f);
+	enableCap(GL_DEPTH_TEST);
+	enableCap(GL_LIGHTING);
+	enableCap(GL_NORMALIZE);
+	enableCap(GL_COLOR_MATERIAL);
+	glShadeModel(GL_SMOOTH);
+	enableCap(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	initPrimitiveMeshes();
+	initWallInstancing();
+	initGroundMesh();
+	initGoalMesh();
+	initRigs();
+	primitiveMeshesFrozen = true;
+	initShaderRenderer(); // after the meshes, so the pool goes up complete
+	initProfiler();
+	initOcclusion();
+	initDrawWorkers();
+}
+
+// Headless benchmark: renders a fixed number of frames into an offscreen
+// framebuffer along a scripted camera path and reports frame-time statistics
+// as JSON. Needs an EGL implementation with surfaceless support (Mesa).
+struct BenchOptions {
+	int frames;
+	int warmupFrames;
+	const char *outputPath;
+	int extraProps; // scattered on top of the authored five
+};
+
+const int BENCH_WIDTH = 640;
+const int BENCH_HEIGHT = 480;
+
+bool createOffscreenContext(int width, int height) {
+#if defined(__linux__)
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (!getPlatformDisplay) {
+		return false;
+	}
+	EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL) || !eglBindAPI(EGL_OPENGL_API)) {
+		return false;
+	}
+	EGLContext context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, NULL);
+	if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+		return false;
+	}
+	GLuint framebuffer, renderbuffers[2];
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glGenRenderbuffers(2, renderbuffers);
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+	glViewport(0, 0, width, height);
+	return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+#else
+	(void)width;
+	(void)height;
+	return false;
+#endif
+}
+
+// Orbits the arena while sweeping the radius and height, so the path covers
+// both the outside views and close-ups inside the base.
+void setBenchCamera(float t) {
+	float angle = t * 2.0f * PI;
+	float radius = 1.2f + 0.8f * cosf(angle * 2.0f);
+	camera.eye = Vector3f(radius * cosf(angle), 0.5f + 0.4f * sinf(angle * 3.0f), radius * sinf(angle));
+	camera.center = Vector3f(0.0f, 0.25f, 0.0f);
+	camera.up = Vector3f(0.0f, 1.0f, 0.0f);
+}
+
+// Nearest-rank percentile of an ascending sample
+double percentile(const std::vector<double> &sorted, double p) {
+	if (sorted.empty()) {
+		return 0.0;
+	}
+	size_t rank = (size_t)ceil(p / 100.0 * sorted.size());
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+void writeBenchStats(FILE *out, const char *name, std::vector<double> samples, bool last) {
+	std::sort(samples.begin(), samples.end());
+	double sum = 0.0;
+	for (size_t i = 0; i < samples.size(); ++i) {
+		sum += samples[i];
+	}
+	double mean = samples.empty() ? 0.0 : sum / samples.size();
+	fprintf(out, "    \"%s\": { \"min\": %.4f, \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f }%s\n",
+		name, samples.empty() ? 0.0 : samples.front(), mean, percentile(samples, 50.0), percentile(samples, 95.0),
+		percentile(samples, 99.0), samples.empty() ? 0.0 : samples.back(), last ? "" : ",");
+}
+
+int runBenchmark(const BenchOptions &options) {
+	headless = true;
+	if (!createOffscreenContext(BENCH_WIDTH, BENCH_HEIGHT)) {
+		fprintf(stderr, "Benchmark mode needs an offscreen EGL context (Linux/Mesa)\n");
+		return EXIT_FAILURE;
+	}
+	initRendering();
+	resetGame();
+	if (options.extraProps > 0) {
+		scatterProps(game, options.extraProps, 1u);
+		syncRenderState();
+	}
+	if (!replay.active) {
+		setPropsActive(game.props, true);
+	}
+	profileSync = true;
+
+	const float dt = 1.0f / 60.0f;
+	std::vector<double> frameTimes;
+	std::vector<double> zoneTimes[ZONE_COUNT];
+	std::vector<double> drawCalls;
+	std::vector<double> indices;
+	std::vector<double> stateChanges;
+	std::vector<double> stateDropped;
+	std::vector<double> culled;
+	std::vector<double> occluded;
+	std::vector<double> transforms;
+	int total = options.warmupFrames + options.frames;
+	// A replay drives the camera and input instead of the scripted path and
+	// ends the run early when it runs out
+	int frame = 0;
+	for (; frame < total && !replayFinished(); ++frame) {
+		if (!replay.active) {
+			setBenchCamera((float)frame / total);
+		}
+		advanceSimulation(dt);
+		double start = nowMillis();
+		Display();
+		double elapsed = nowMillis() - start;
+		if (frame < options.warmupFrames) {
+			continue;
+		}
+		frameTimes.push_back(elapsed);
+		for (int z = 0; z < ZONE_COUNT; ++z) {
+			zoneTimes[z].push_back(lastZoneMillis(z));
+		}
+		drawCalls.push_back(lastFrameCounters.drawCalls);
+		indices.push_back((double)lastFrameCounters.indices);
+		stateChanges.push_back(lastFrameCounters.stateChanges);
+		stateDropped.push_back(lastFrameCounters.stateDropped);
+		culled.push_back(lastFrameCounters.culled);
+		occluded.push_back(lastFrameCounters.occluded);
+		transforms.push_back(lastFrameCounters.transforms);
+	}
+
+	FILE *out = options.outputPath ? fopen(options.outputPath, "w") : stdout;
+	if (!out) {
+		fprintf(stderr, "Cannot write %s\n", options.outputPath);
+		return EXIT_FAILURE;
+	}
+	fprintf(out, "{\n");
+	fprintf(out, "  \"renderer\": \"%s\",\n", (const char *)glGetString(GL_RENDERER));
+	fprintf(out, "  \"backend\": \"%s\",\n", shaderRenderer.active ? "shader" : "fixed");
+	fprintf(out, "  \"width\": %d,\n  \"height\": %d,\n  \"frames\": %d,\n", BENCH_WIDTH, BENCH_HEIGHT, (int)frameTimes.size());
+	fprintf(out, "  \"frame_ms\": {\n");
+	writeBenchStats(out, "total", frameTimes, true);
+	fprintf(out, "  },\n  \"sections_ms\": {\n");
+	for (int z = 0; z < ZONE_COUNT; ++z) {
+		writeBenchStats(out, PROFILE_ZONE_NAMES[z], zoneTimes[z], z == ZONE_COUNT - 1);
+	}
+	fprintf(out, "  },\n  \"counters\": {\n");
+	writeBenchStats(out, "draw_calls", drawCalls, false);
+	writeBenchStats(out, "indices", indices, false);
+	writeBenchStats(out, "state_changes", stateChanges, false);
+	writeBenchStats(out, "state_dropped", stateDropped, false);
+	writeBenchStats(out, "objects_culled", culled, false);
+	writeBenchStats(out, "objects_occluded", occluded, false);
+	writeBenchStats(out, "transforms", transforms, true);
+	fprintf(out, "  }\n}\n");
+	if (out != stdout) {
+		fclose(out);
+	}
+	return EXIT_SUCCESS;
+}
+
+// Headless playthrough runner: plays many independent sessions across all
+// cores with scripted or random input and summarizes the outcomes as JSON.
+// Used to balance the timer and goal layout without a window.
+enum SimPolicy {
+	POLICY_RANDOM, // hold a random direction for a random 0.25-1 s
+	POLICY_GREEDY  // steer straight at the nearest remaining goal
+};
+
+struct SimOptions {
+	int sessions;
+	int threads;
+	unsigned int seed;
+	SimPolicy policy;
+	float timeLimit;
+	int extraGoals; // scattered on top of the authored three
+};
+
+struct SimResult {
+	bool won;
+	int goalsCollected;
+	unsigned int ticks;
+};
+
+void chooseRandomInput(GameSession &s, std::mt19937 &rng) {
+	unsigned int bits = rng();
+	s.moveForward = (bits & 3) == 1;
+	s.moveBackward = (bits & 3) == 2;
+	s.moveLeft = ((bits >> 2) & 3) == 1;
+	s.moveRight = ((bits >> 2) & 3) == 2;
+	s.moveUp = ((bits >> 4) & 3) == 1;
+	s.moveDown = ((bits >> 4) & 3) == 2;
+}
+
+void chooseGreedyInput(GameSession &s) {
+	const GoalStore &goals = s.goals;
+	const Vector3f &p = s.player.position;
+	int target = nearestPoint(goals.x.data(), goals.y.data(), goals.z.data(), goals.collected.data(), (int)goals.size(), p.x, p.y, p.z);
+	s.moveForward = s.moveBackward = s.moveLeft = s.moveRight = s.moveUp = s.moveDown = false;
+	if (target < 0) {
+		return;
+	}
+	const float deadZone = 0.01f;
+	Vector3f diff = Vector3f(goals.x[target], goals.y[target], goals.z[target]) - p;
+	s.moveForward = diff.z < -deadZone;
+	s.moveBackward = diff.z > deadZone;
+	s.moveLeft = diff.x < -deadZone;
+	s.moveRight = diff.x > deadZone;
+	s.moveUp = diff.y > deadZone;
+	s.moveDown = diff.y < -deadZone;
+}
+
+SimResult runSession(const SimOptions &options, int index) {
+	GameSession s;
+	resetSession(s, options.timeLimit);
+	if (options.extraGoals > 0) {
+		scatterGoals(s, options.extraGoals, options.seed + (unsigned int)index);
+	}
+	std::mt19937 rng(options.seed ^ (2654435761u * (unsigned int)(index + 1)));
+	int holdTicks = 0;
+	SimResult result = { false, 0, 0 };
+	while (s.state == STATE_PLAYING) {
+		if (options.policy == POLICY_GREEDY) {
+			chooseGreedyInput(s);
+		} else if (--holdTicks <= 0) {
+			chooseRandomInput(s, rng);
+			holdTicks = 30 + (int)(rng() % 91);
+		}
+		clearSessionEvents(s);
+		stepSession(s, SIM_STEP);
+		++result.ticks;
+	}
+	result.won = s.state == STATE_WIN;
+	result.goalsCollected = (int)s.goals.size() - goalsRemaining(s);
+	return result;
+}
+
+int runSimulations(const SimOptions &options) {
+	std::vector<SimResult> results(options.sessions);
+	std::atomic<int> next(0);
+	double start = nowMillis();
+	std::vector<std::thread> workers;
+	for (int t = 0; t < options.threads; ++t) {
+		workers.push_back(std::thread([&]() {
+			for (int i = next++; i < options.sessions; i = next++) {
+				results[i] = runSession(options, i);
+			}
+		}));
+	}
+	for (size_t t = 0; t < workers.size(); ++t) {
+		workers[t].join();
+	}
+	double elapsed = nowMillis() - start;
+
+	int wins = 0;
+	double goalsCollected = 0.0;
+	double totalTicks = 0.0;
+	std::vector<double> winTimes;
+	for (size_t i = 0; i < results.size(); ++i) {
+		goalsCollected += results[i].goalsCollected;
+		totalTicks += results[i].ticks;
+		if (results[i].won) {
+			++wins;
+			winTimes.push_back(results[i].ticks * SIM_STEP);
+		}
+	}
+	int count = options.sessions > 0 ? options.sessions : 1;
+	printf("{\n");
+	printf("  \"sessions\": %d,\n  \"threads\": %d,\n  \"seed\": %u,\n", options.sessions, options.threads, options.seed);
+	printf("  \"policy\": \"%s\",\n  \"time_limit_s\": %.2f,\n", options.policy == POLICY_GREEDY ? "greedy" : "random", options.timeLimit);
+	printf("  \"wins\": %d,\n  \"win_rate\": %.4f,\n  \"goals_collected_mean\": %.4f,\n", wins, (double)wins / count, goalsCollected / count);
+	printf("  \"win_time_s\": {\n");
+	writeBenchStats(stdout, "completion", winTimes, true);
+	printf("  },\n");
+	printf("  \"wall_ms\": %.1f,\n  \"sessions_per_second\": %.1f,\n  \"steps_per_second\": %.0f\n", elapsed, options.sessions / (elapsed / 1000.0), totalTicks / (elapsed / 1000.0));
+	printf("}\n");
+	return EXIT_SUCCESS;
+}
+
 void UpdateTimer(int) {
-	int now = glutGet(GLUT_ELAPSED_TIME);
-	float dt = (now - lastTick) / 1000.0f;
+	TraceScope trace("UpdateTimer");
+	int now = elapsedMillis();
+	float frameTime = (now - lastTick) / 1000.0f;
 	lastTick = now;
-	updateGame(dt);
+	pollAudioAssets();
+	if (replay.fast) {
+		advanceSimulation(1.0f / 60.0f);
+		if (replayFinished()) {
+			printf("Replayed %u ticks\n", simTick);
+			exit(EXIT_SUCCESS);
+		}
+		glutPostRedisplay();
+		glutTimerFunc(0, UpdateTimer, 0);
+		return;
+	}
+	advanceSimulation(frameTime);
+	if (replayFinished()) {
+		printf("Replay finished at tick %u, input is live again\n", simTick);
+		replay.active = false;
+	}
 	glutPostRedisplay();
 	glutTimerFunc(16, UpdateTimer, 0);
 }
 
 int main(int argc, char **argv) {
+	bool benchMode = false;
+	BenchOptions bench = { 600, 30, NULL, 0 };
+	const char *recordPath = NULL;
+	const char *replayPath = NULL;
+#if defined(__APPLE__)
+	AudioBackend audioBackend = AUDIO_BACKEND_DEVICE;
+#else
+	AudioBackend audioBackend = AUDIO_BACKEND_NULL;
+#endif
+	const char *audioPath = NULL;
+	const char *tracePath = NULL;
+	const char *scenePath = NULL;
+	unsigned int hardwareThreads = std::thread::hardware_concurrency();
+	SimOptions sim = { 0, hardwareThreads > 0 ? (int)hardwareThreads : 1, 1u, POLICY_RANDOM, GAME_TIME_LIMIT, 0 };
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--bench") == 0) {
+			benchMode = true;
+		} else if (strcmp(argv[i], "--simulate") == 0 && i + 1 < argc) {
+			sim.sessions = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--sim-threads") == 0 && i + 1 < argc) {
+			sim.threads = atoi(argv[++i]) > 0 ? atoi(argv[i]) : 1;
+		} else if (strcmp(argv[i], "--sim-seed") == 0 && i + 1 < argc) {
+			sim.seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+		} else if (strcmp(argv[i], "--sim-policy") == 0 && i + 1 < argc) {
+			sim.policy = strcmp(argv[++i], "greedy") == 0 ? POLICY_GREEDY : POLICY_RANDOM;
+		} else if (strcmp(argv[i], "--sim-goals") == 0 && i + 1 < argc) {
+			sim.extraGoals = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--sim-time") == 0 && i + 1 < argc) {
+			sim.timeLimit = (float)atof(argv[++i]);
+		} else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+			recordPath = argv[++i];
+		} else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+			replayPath = argv[++i];
+		} else if (strcmp(argv[i], "--audio-out") == 0 && i + 1 < argc) {
+			audioBackend = AUDIO_BACKEND_WAV;
+			audioPath = argv[++i];
+		} else if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc) {
+			scenePath = argv[++i];
+		} else if (strcmp(argv[i], "--scene-compile") == 0 && i + 2 < argc) {
+			return compileScene(argv[i + 1], argv[i + 2]);
+		} else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+			tracePath = argv[++i];
+		} else if (strcmp(argv[i], "--no-cull") == 0) {
+			cullingEnabled = false;
+		} else if (strcmp(argv[i], "--no-occlusion") == 0) {
+			occlusion.enabled = false;
+		} else if (strcmp(argv[i], "--renderer") == 0 && i + 1 < argc) {
+			const char *renderer = argv[++i];
+			if (strcmp(renderer, "fixed") == 0) {
+				requestedRenderer = RENDERER_FIXED;
+			} else if (strcmp(renderer, "shader") == 0) {
+				requestedRenderer = RENDERER_SHADER;
+			} else {
+				fprintf(stderr, "Unknown renderer %s (expected fixed or shader)\n", renderer);
+				return EXIT_FAILURE;
+			}
+		} else if (strcmp(argv[i], "--draw-threads") == 0 && i + 1 < argc) {
+			drawThreads = std::max(0, atoi(argv[++i]));
+		} else if (strcmp(argv[i], "--no-lod") == 0) {
+			lodEnabled = false;
+		} else if (strcmp(argv[i], "--no-audio") == 0) {
+			audioBackend = AUDIO_BACKEND_NULL;
+		} else if (strcmp(argv[i], "--replay-fast") == 0) {
+			replay.fast = true;
+		} else if (strcmp(argv[i], "--bench-frames") == 0 && i + 1 < argc) {
+			bench.frames = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--bench-props") == 0 && i + 1 < argc) {
+			bench.extraProps = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--bench-out") == 0 && i + 1 < argc) {
+			bench.outputPath = argv[++i];
+		}
+	}
+	if (scenePath && !loadScene(scenePath)) {
+		return EXIT_FAILURE;
+	}
+	if (sim.sessions > 0) {
+		return runSimulations(sim);
+	}
+	if (replayPath && !loadReplay(replayPath)) {
+		fprintf(stderr, "Cannot read replay %s\n", replayPath);
+		return EXIT_FAILURE;
+	}
+	replay.fast = replay.fast && replay.active;
+	if (tracePath) {
+		if (!startTracing(tracePath)) {
+			fprintf(stderr, "Cannot write trace %s\n", tracePath);
+			return EXIT_FAILURE;
+		}
+		atexit(stopTracing);
+	}
+	if (benchMode) {
+		return runBenchmark(bench);
+	}
+	if (recordPath && !startRecording(recordPath)) {
+		fprintf(stderr, "Cannot write recording %s\n", recordPath);
+		return EXIT_FAILURE;
+	}
+	if (!initAudio(audioBackend, audioPath)) {
+		fprintf(stderr, "Cannot write audio %s\n", audioPath);
+		return EXIT_FAILURE;
+	}
+	atexit(shutdownAudio);
+
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
 	glutInitWindowSize(640, 480);
 	glutInitWindowPosition(50, 50);
 	glutCreateWindow("Underwater Base");
 	glutDisplayFunc(Display);
+	glutReshapeFunc(Reshape);
 	glutKeyboardFunc(Keyboard);
 	glutKeyboardUpFunc(KeyboardUp);
 	glutSpecialFunc(Special);
-	glClearColor(0.03f, 0.12f, 0.18f, 1.0f);
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_LIGHTING);
-	glEnable(GL_LIGHT0);
-	glEnable(GL_NORMALIZE);
-	glEnable(GL_COLOR_MATERIAL);
-	glShadeModel(GL_SMOOTH);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-#if defined(__APPLE__)
-	atexit(stopBackgroundMusic);
-#endif
-	checkMusicAssets();  // Check which audio files exist
+	initRendering();
+	loadAudioAssets();  // Decoded in the background; playback never touches the disk
 	resetGame();
 	glutTimerFunc(16, UpdateTimer, 0);
 	glutMainLoop();